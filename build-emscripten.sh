@@ -18,4 +18,16 @@ fi
 mkdir -p ./dist
 cp ./build-wasm/src/kakadujs.js ./dist
 cp ./build-wasm/src/kakadujs.wasm ./dist
+cp ./build-wasm/src/kakadujs-scalar.js ./dist
+cp ./build-wasm/src/kakadujs-scalar.wasm ./dist
+cp ./build-wasm/src/kakadujs-loader.js ./dist
+if [ -f ./build-wasm/src/kakadujs-mt.js ]; then
+    cp ./build-wasm/src/kakadujs-mt.js ./dist
+    cp ./build-wasm/src/kakadujs-mt.wasm ./dist
+    # older EMSCRIPTEN versions emit the pthread worker as a separate file
+    cp ./build-wasm/src/kakadujs-mt.worker.js ./dist 2>/dev/null || true
+fi
 (cd test/node; npm run test)
+if [ -f ./dist/kakadujs-mt.js ]; then
+    (cd test/node; npm run test:mt)
+fi
@@ -0,0 +1,25 @@
+// Copyright (c) Chris Hafey.
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include <cstddef>
+
+/// <summary>
+/// A range of bytes of an encoded bitstream, e.g. for an HTTP range request
+/// (bytes=offset-(offset + length - 1))
+/// </summary>
+struct ByteRange {
+    ByteRange() : offset(0), length(0) {}
+    ByteRange(size_t offset, size_t length) : offset(offset), length(length) {}
+
+    /// <summary>
+    /// Offset of the first byte from the start of the bitstream
+    /// </summary>
+    size_t offset;
+
+    /// <summary>
+    /// Number of bytes
+    /// </summary>
+    size_t length;
+};
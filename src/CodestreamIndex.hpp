@@ -0,0 +1,602 @@
+// Copyright (c) Chris Hafey.
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include "ByteRange.hpp"
+
+/// <summary>
+/// Parses the main and tile-part headers of a JPEG 2000 codestream (including
+/// TLM and PLT pointer markers) to plan the byte ranges needed to decode a
+/// resolution, region and number of quality layers, see
+/// HTJ2KDecoder::getByteRanges().  The codestream may be sparse, i.e. only
+/// some ranges of it have been received, in which case the planner asks for
+/// the header bytes it is missing.
+///
+/// Tiles outside the region are skipped.  Within a tile only a prefix of its
+/// packets is kept, which requires PLT markers and a progression where the
+/// wanted packets come first (LRCP for layers, RLCP and RPCL for
+/// resolutions).  Anything else (no PLT, PCRL/CPRL, COC/POC/PPM/PPT, SOP/EPH
+/// markers) keeps the whole tile.  Kakadu reads the packets of a tile in
+/// order so the bytes that are not fetched read as empty packets after the
+/// last one needed.
+/// </summary>
+class CodestreamIndex
+{
+public:
+    /// <summary>
+    /// data/size is the encoded bitstream.  filled lists the ranges of it that
+    /// hold data (sorted and merged) or is NULL if all of it does
+    /// </summary>
+    CodestreamIndex(const uint8_t *data, size_t size, const std::vector<ByteRange> *pFilled)
+        : data_(data), size_(size), pFilled_(pFilled), x0_(0), y0_(0), x1_(0), y1_(0),
+          tileWidth_(0), tileHeight_(0), tileX0_(0), tileY0_(0), numTilesX_(0), numTilesY_(0),
+          isMainComplex_(false) {}
+
+    /// <summary>
+    /// Appends the ranges needed to decode the region (x, y, width, height in
+    /// image coordinates, width or height 0 for the whole image) at
+    /// decompositionLevel with numLayers quality layers (0 = all) to ranges.
+    /// Returns false if header bytes needed to plan are missing, ranges then
+    /// also holds the header bytes to fetch next.
+    /// </summary>
+    bool plan(size_t decompositionLevel, size_t x, size_t y, size_t width, size_t height, size_t numLayers, std::vector<ByteRange> &ranges)
+    {
+        size_t soc;
+        if (!findCodestream_(soc, ranges))
+        {
+            return false;
+        }
+
+        // main header
+        size_t offset = soc + 2;
+        while (true)
+        {
+            if (!require_(offset, 4, ranges))
+            {
+                return false;
+            }
+            const uint16_t marker = read16_(offset);
+            if (marker == 0xFF90) // SOT
+            {
+                break;
+            }
+            if ((marker >> 8) != 0xFF)
+            {
+                throw "invalid marker in the main header";
+            }
+            const size_t segmentSize = 2 + read16_(offset + 2);
+            if (!require_(offset, segmentSize, ranges))
+            {
+                return false;
+            }
+            parseMainSegment_(marker, offset + 4, segmentSize - 4);
+            offset += segmentSize;
+        }
+        if (numTilesX_ == 0)
+        {
+            throw "the main header has no SIZ marker";
+        }
+        ranges.push_back(ByteRange(0, offset));
+
+        // tile-part headers, located via TLM if present so the missing ones
+        // can be requested at once, otherwise by following the SOT lengths
+        const bool useTLM = !tileLengths_.empty();
+        bool isComplete = true;
+        for (size_t i = 0; !useTLM || i < tileLengths_.size(); i++)
+        {
+            const size_t start = offset;
+            if (useTLM)
+            {
+                offset += tileLengths_[i];
+            }
+            else
+            {
+                if (offset + 2 > size_)
+                {
+                    break;
+                }
+                if (!require_(offset, 2, ranges))
+                {
+                    return false;
+                }
+                if (read16_(offset) == 0xFFD9) // EOC
+                {
+                    break;
+                }
+            }
+            if (!parseTilePart_(start, ranges))
+            {
+                if (!useTLM)
+                {
+                    return false;
+                }
+                isComplete = false;
+                continue;
+            }
+            ranges.push_back(ByteRange(start, tileParts_.back().dataStart - start));
+            if (!useTLM)
+            {
+                offset = tileParts_.back().end;
+            }
+        }
+        if (!isComplete)
+        {
+            return false;
+        }
+
+        // the packet data of the tiles in the region
+        for (size_t tile = 0; tile < tiles_.size(); tile++)
+        {
+            if (tiles_[tile].tileParts.empty() || !intersects_(tile, x, y, width, height))
+            {
+                continue;
+            }
+            size_t needed = getPacketBytes_(tile, decompositionLevel, numLayers);
+            for (size_t i = 0; i < tiles_[tile].tileParts.size() && needed > 0; i++)
+            {
+                const TilePart &tilePart = tileParts_[tiles_[tile].tileParts[i]];
+                const size_t length = std::min(needed, tilePart.end - tilePart.dataStart);
+                if (length > 0)
+                {
+                    ranges.push_back(ByteRange(tilePart.dataStart, length));
+                }
+                if (needed != SIZE_MAX)
+                {
+                    needed -= length;
+                }
+            }
+        }
+        if (size_ >= 2)
+        {
+            ranges.push_back(ByteRange(size_ - 2, 2)); // EOC
+        }
+        return true;
+    }
+
+    /// <summary>
+    /// Returns the offset of the SOC marker in data, skipping any JP2 boxes
+    /// preceding the codestream by searching for SOC followed by SIZ.  Returns
+    /// size if there is no codestream
+    /// </summary>
+    static size_t findCodestream(const uint8_t *data, size_t size)
+    {
+        for (size_t offset = 0; offset + 4 <= size; offset++)
+        {
+            if (data[offset] == 0xFF && data[offset + 1] == 0x4F && data[offset + 2] == 0xFF && data[offset + 3] == 0x51)
+            {
+                return offset;
+            }
+        }
+        return size;
+    }
+
+    /// <summary>
+    /// Sorts ranges and merges the overlapping and adjacent ones
+    /// </summary>
+    static void merge(std::vector<ByteRange> &ranges)
+    {
+        std::sort(ranges.begin(), ranges.end(), [](const ByteRange &a, const ByteRange &b)
+                  { return a.offset < b.offset; });
+        size_t count = 0;
+        for (size_t i = 0; i < ranges.size(); i++)
+        {
+            if (ranges[i].length == 0)
+            {
+                continue;
+            }
+            if (count > 0 && ranges[i].offset <= ranges[count - 1].offset + ranges[count - 1].length)
+            {
+                const size_t end = std::max(ranges[count - 1].offset + ranges[count - 1].length, ranges[i].offset + ranges[i].length);
+                ranges[count - 1].length = end - ranges[count - 1].offset;
+            }
+            else
+            {
+                ranges[count++] = ranges[i];
+            }
+        }
+        ranges.resize(count);
+    }
+
+    /// <summary>
+    /// Returns the parts of ranges not covered by filled, both must be merged
+    /// </summary>
+    static std::vector<ByteRange> subtract(const std::vector<ByteRange> &ranges, const std::vector<ByteRange> &filled)
+    {
+        std::vector<ByteRange> result;
+        size_t f = 0;
+        for (size_t i = 0; i < ranges.size(); i++)
+        {
+            size_t offset = ranges[i].offset;
+            const size_t end = ranges[i].offset + ranges[i].length;
+            while (f < filled.size() && filled[f].offset + filled[f].length <= offset)
+            {
+                f++;
+            }
+            for (size_t j = f; j < filled.size() && filled[j].offset < end && offset < end; j++)
+            {
+                if (filled[j].offset > offset)
+                {
+                    result.push_back(ByteRange(offset, filled[j].offset - offset));
+                }
+                offset = std::max(offset, filled[j].offset + filled[j].length);
+            }
+            if (offset < end)
+            {
+                result.push_back(ByteRange(offset, end - offset));
+            }
+        }
+        return result;
+    }
+
+private:
+    // the bytes requested when the length of a header is not known yet
+    static const size_t headerFetchSize_ = 16384;
+
+    // the COD parameters the packet count depends on
+    struct CodingStyle
+    {
+        CodingStyle() : progression(0), numLayers(1), numLevels(0), hasMarkers(false)
+        {
+            std::fill(precinctX, precinctX + 33, 15);
+            std::fill(precinctY, precinctY + 33, 15);
+        }
+
+        uint8_t progression;
+        size_t numLayers;
+        size_t numLevels;
+        bool hasMarkers; // SOP or EPH
+        uint8_t precinctX[33];
+        uint8_t precinctY[33];
+    };
+
+    struct TilePart
+    {
+        size_t dataStart;
+        size_t end;
+        bool hasPLT;
+        std::vector<size_t> packetLengths;
+    };
+
+    struct Tile
+    {
+        Tile() : hasCOD(false), isComplex(false) {}
+
+        bool hasCOD;
+        CodingStyle cod;
+        bool isComplex;
+        std::vector<size_t> tileParts;
+    };
+
+    uint16_t read16_(size_t offset) const
+    {
+        return (uint16_t)((data_[offset] << 8) | data_[offset + 1]);
+    }
+
+    uint32_t read32_(size_t offset) const
+    {
+        return ((uint32_t)read16_(offset) << 16) | read16_(offset + 2);
+    }
+
+    static size_t ceilDiv_(size_t a, size_t b)
+    {
+        return (a + b - 1) / b;
+    }
+
+    bool isAvailable_(size_t offset, size_t length) const
+    {
+        if (!pFilled_)
+        {
+            return true;
+        }
+        for (size_t i = 0; i < pFilled_->size() && (*pFilled_)[i].offset <= offset; i++)
+        {
+            if (offset + length <= (*pFilled_)[i].offset + (*pFilled_)[i].length)
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // returns true if the bytes are available, otherwise appends a request
+    // for them (at least headerFetchSize_ bytes) to ranges
+    bool require_(size_t offset, size_t length, std::vector<ByteRange> &ranges) const
+    {
+        if (offset + length > size_)
+        {
+            throw "the codestream is truncated";
+        }
+        if (isAvailable_(offset, length))
+        {
+            return true;
+        }
+        ranges.push_back(ByteRange(offset, std::min(std::max(length, (size_t)headerFetchSize_), size_ - offset)));
+        return false;
+    }
+
+    // finds SOC followed by SIZ in the leading available bytes, skipping any
+    // JP2 boxes
+    bool findCodestream_(size_t &soc, std::vector<ByteRange> &ranges) const
+    {
+        size_t available = size_;
+        if (pFilled_)
+        {
+            available = (!pFilled_->empty() && (*pFilled_)[0].offset == 0) ? (*pFilled_)[0].length : 0;
+        }
+        soc = findCodestream(data_, available);
+        if (soc < available)
+        {
+            return true;
+        }
+        if (available >= size_)
+        {
+            throw "no JPEG 2000 codestream found";
+        }
+        ranges.push_back(ByteRange(available, std::min((size_t)headerFetchSize_, size_ - available)));
+        return false;
+    }
+
+    void parseCOD_(size_t offset, size_t size, CodingStyle &cod) const
+    {
+        const uint8_t scod = data_[offset];
+        cod.progression = data_[offset + 1];
+        cod.numLayers = read16_(offset + 2);
+        cod.numLevels = std::min((size_t)data_[offset + 5], (size_t)32);
+        cod.hasMarkers = (scod & 0x06) != 0;
+        if (scod & 0x01)
+        {
+            for (size_t r = 0; r <= cod.numLevels && 10 + r < size; r++)
+            {
+                cod.precinctX[r] = data_[offset + 10 + r] & 0x0F;
+                cod.precinctY[r] = data_[offset + 10 + r] >> 4;
+            }
+        }
+    }
+
+    void parseMainSegment_(uint16_t marker, size_t offset, size_t size)
+    {
+        if (marker == 0xFF51) // SIZ
+        {
+            x1_ = read32_(offset + 2);
+            y1_ = read32_(offset + 6);
+            x0_ = read32_(offset + 10);
+            y0_ = read32_(offset + 14);
+            tileWidth_ = read32_(offset + 18);
+            tileHeight_ = read32_(offset + 22);
+            tileX0_ = read32_(offset + 26);
+            tileY0_ = read32_(offset + 30);
+            const size_t numComponents = read16_(offset + 34);
+            if (tileWidth_ == 0 || tileHeight_ == 0 || x1_ <= x0_ || y1_ <= y0_ || 36 + numComponents * 3 > size)
+            {
+                throw "invalid SIZ marker";
+            }
+            subsampling_.clear();
+            for (size_t c = 0; c < numComponents; c++)
+            {
+                subsampling_.push_back(std::make_pair(std::max(data_[offset + 37 + c * 3], (uint8_t)1),
+                                                      std::max(data_[offset + 38 + c * 3], (uint8_t)1)));
+            }
+            numTilesX_ = ceilDiv_(x1_ - tileX0_, tileWidth_);
+            numTilesY_ = ceilDiv_(y1_ - tileY0_, tileHeight_);
+            tiles_.resize(numTilesX_ * numTilesY_);
+        }
+        else if (marker == 0xFF52) // COD
+        {
+            parseCOD_(offset, size, mainCOD_);
+        }
+        else if (marker == 0xFF55 && size >= 2) // TLM
+        {
+            const uint8_t stlm = data_[offset + 1];
+            const size_t indexSize = (stlm >> 4) & 0x03;
+            const size_t lengthSize = (stlm & 0x40) ? 4 : 2;
+            for (size_t entry = offset + 2 + indexSize; entry + lengthSize <= offset + size; entry += indexSize + lengthSize)
+            {
+                tileLengths_.push_back(lengthSize == 4 ? read32_(entry) : read16_(entry));
+            }
+        }
+        else if (marker == 0xFF53 || marker == 0xFF5F || marker == 0xFF60) // COC, POC, PPM
+        {
+            isMainComplex_ = true;
+        }
+    }
+
+    // parses the tile-part header at start, returns false if bytes are missing
+    bool parseTilePart_(size_t start, std::vector<ByteRange> &ranges)
+    {
+        if (!require_(start, 12, ranges))
+        {
+            return false;
+        }
+        if (read16_(start) != 0xFF90)
+        {
+            throw "expected a SOT marker";
+        }
+        const size_t tile = read16_(start + 4);
+        const size_t length = read32_(start + 6);
+        if (tile >= tiles_.size())
+        {
+            throw "invalid tile index in a SOT marker";
+        }
+        TilePart tilePart;
+        tilePart.hasPLT = false;
+        tilePart.end = length ? start + length : size_ - 2;
+        if (tilePart.end > size_)
+        {
+            throw "the codestream is truncated";
+        }
+        size_t offset = start + 12;
+        while (true)
+        {
+            if (!require_(offset, 2, ranges))
+            {
+                return false;
+            }
+            const uint16_t marker = read16_(offset);
+            if (marker == 0xFF93) // SOD
+            {
+                tilePart.dataStart = offset + 2;
+                break;
+            }
+            if ((marker >> 8) != 0xFF || offset + 4 > tilePart.end)
+            {
+                throw "invalid marker in a tile-part header";
+            }
+            if (!require_(offset, 4, ranges))
+            {
+                return false;
+            }
+            const size_t segmentSize = 2 + read16_(offset + 2);
+            if (!require_(offset, segmentSize, ranges))
+            {
+                return false;
+            }
+            if (marker == 0xFF52) // COD
+            {
+                tiles_[tile].hasCOD = true;
+                parseCOD_(offset + 4, segmentSize - 4, tiles_[tile].cod);
+            }
+            else if (marker == 0xFF58) // PLT
+            {
+                tilePart.hasPLT = true;
+                size_t value = 0;
+                for (size_t i = offset + 5; i < offset + segmentSize; i++)
+                {
+                    value = (value << 7) | (data_[i] & 0x7F);
+                    if (!(data_[i] & 0x80))
+                    {
+                        tilePart.packetLengths.push_back(value);
+                        value = 0;
+                    }
+                }
+            }
+            else if (marker == 0xFF53 || marker == 0xFF5F || marker == 0xFF61) // COC, POC, PPT
+            {
+                tiles_[tile].isComplex = true;
+            }
+            offset += segmentSize;
+        }
+        tiles_[tile].tileParts.push_back(tileParts_.size());
+        tileParts_.push_back(tilePart);
+        return true;
+    }
+
+    // the tile's bounds on the canvas
+    void getTileBounds_(size_t tile, size_t &tx0, size_t &ty0, size_t &tx1, size_t &ty1) const
+    {
+        const size_t p = tile % numTilesX_;
+        const size_t q = tile / numTilesX_;
+        tx0 = std::max(tileX0_ + p * tileWidth_, x0_);
+        ty0 = std::max(tileY0_ + q * tileHeight_, y0_);
+        tx1 = std::min(tileX0_ + (p + 1) * tileWidth_, x1_);
+        ty1 = std::min(tileY0_ + (q + 1) * tileHeight_, y1_);
+    }
+
+    bool intersects_(size_t tile, size_t x, size_t y, size_t width, size_t height) const
+    {
+        if (width == 0 || height == 0)
+        {
+            return true;
+        }
+        size_t tx0, ty0, tx1, ty1;
+        getTileBounds_(tile, tx0, ty0, tx1, ty1);
+        return tx0 < x0_ + x + width && x0_ + x < tx1 && ty0 < y0_ + y + height && y0_ + y < ty1;
+    }
+
+    // returns the number of packet data bytes of the tile needed, SIZE_MAX if
+    // the whole tile is
+    size_t getPacketBytes_(size_t tile, size_t decompositionLevel, size_t numLayers) const
+    {
+        const Tile &t = tiles_[tile];
+        const CodingStyle &cod = t.hasCOD ? t.cod : mainCOD_;
+        if (isMainComplex_ || t.isComplex || cod.hasMarkers || cod.progression > 2)
+        {
+            return SIZE_MAX;
+        }
+        std::vector<size_t> lengths;
+        for (size_t i = 0; i < t.tileParts.size(); i++)
+        {
+            const TilePart &tilePart = tileParts_[t.tileParts[i]];
+            if (!tilePart.hasPLT)
+            {
+                return SIZE_MAX;
+            }
+            lengths.insert(lengths.end(), tilePart.packetLengths.begin(), tilePart.packetLengths.end());
+        }
+
+        // the number of precincts of each resolution summed over the components
+        size_t tx0, ty0, tx1, ty1;
+        getTileBounds_(tile, tx0, ty0, tx1, ty1);
+        std::vector<size_t> precincts(cod.numLevels + 1, 0);
+        for (size_t c = 0; c < subsampling_.size(); c++)
+        {
+            const size_t cx0 = ceilDiv_(tx0, subsampling_[c].first), cx1 = ceilDiv_(tx1, subsampling_[c].first);
+            const size_t cy0 = ceilDiv_(ty0, subsampling_[c].second), cy1 = ceilDiv_(ty1, subsampling_[c].second);
+            for (size_t r = 0; r <= cod.numLevels; r++)
+            {
+                const size_t scale = (size_t)1 << (cod.numLevels - r);
+                const size_t rx0 = ceilDiv_(cx0, scale), rx1 = ceilDiv_(cx1, scale);
+                const size_t ry0 = ceilDiv_(cy0, scale), ry1 = ceilDiv_(cy1, scale);
+                if (rx1 > rx0 && ry1 > ry0)
+                {
+                    precincts[r] += (ceilDiv_(rx1, (size_t)1 << cod.precinctX[r]) - (rx0 >> cod.precinctX[r])) *
+                                    (ceilDiv_(ry1, (size_t)1 << cod.precinctY[r]) - (ry0 >> cod.precinctY[r]));
+                }
+            }
+        }
+
+        // the wanted packets are a prefix of the tile's packets
+        const size_t lastResolution = decompositionLevel >= cod.numLevels ? 0 : cod.numLevels - decompositionLevel;
+        const size_t layers = numLayers == 0 ? cod.numLayers : std::min(numLayers, cod.numLayers);
+        if (layers == 0)
+        {
+            return SIZE_MAX;
+        }
+        size_t perLayer = 0, upToResolution = 0;
+        for (size_t r = 0; r <= cod.numLevels; r++)
+        {
+            perLayer += precincts[r];
+            upToResolution += r <= lastResolution ? precincts[r] : 0;
+        }
+        size_t numPackets;
+        if (cod.progression == 0) // LRCP
+        {
+            numPackets = (layers - 1) * perLayer + upToResolution;
+        }
+        else if (cod.progression == 1) // RLCP
+        {
+            numPackets = (upToResolution - precincts[lastResolution]) * cod.numLayers + layers * precincts[lastResolution];
+        }
+        else // RPCL
+        {
+            numPackets = upToResolution * cod.numLayers;
+        }
+        if (numPackets > lengths.size())
+        {
+            return SIZE_MAX;
+        }
+        size_t bytes = 0;
+        for (size_t i = 0; i < numPackets; i++)
+        {
+            bytes += lengths[i];
+        }
+        return bytes;
+    }
+
+    const uint8_t *data_;
+    size_t size_;
+    const std::vector<ByteRange> *pFilled_;
+    size_t x0_, y0_, x1_, y1_;
+    size_t tileWidth_, tileHeight_, tileX0_, tileY0_;
+    size_t numTilesX_, numTilesY_;
+    std::vector<std::pair<uint8_t, uint8_t>> subsampling_;
+    CodingStyle mainCOD_;
+    bool isMainComplex_;
+    std::vector<size_t> tileLengths_;
+    std::vector<Tile> tiles_;
+    std::vector<TilePart> tileParts_;
+};
@@ -3,10 +3,19 @@
 
 #pragma once
 
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstring>
 #include <exception>
+#include <functional>
 #include <memory>
 #include <limits.h>
 
+#ifndef KDU_NO_THREADS
+#include <thread>
+#endif
+
 // Kakadu core includes
 #include "kdu_elementary.h"
 #include "kdu_messaging.h"
@@ -22,25 +31,114 @@
 #include <emscripten/val.h>
 #endif
 
+#include "ByteRange.hpp"
+#include "CodestreamIndex.hpp"
 #include "FrameInfo.hpp"
+#ifndef __EMSCRIPTEN__
+#include "MappedFile.hpp"
+#endif
+#include "OutputFormat.hpp"
 #include "Point.hpp"
 #include "Size.hpp"
+#include "Stats.hpp"
+#include "ThreadEnv.hpp"
+#include "VOI.hpp"
 
 #define ojph_div_ceil(a, b) (((a) + (b)-1) / (b))
 
+/// <summary>
+/// Kakadu compressed source over an encoded buffer that keeps growing while
+/// the codestream is open, see HTJ2KDecoder::beginIncrementalDecode().  Every
+/// read sees the bytes appended so far.  The vector is accessed on each read
+/// rather than through a cached pointer so it may reallocate between reads
+/// </summary>
+class kdu_growing_source : public kdu_core::kdu_compressed_source
+{
+public: // Member functions
+  kdu_growing_source(const std::vector<uint8_t> &encoded, size_t offset) : pEncoded_(&encoded),
+                                                                           offset_(offset),
+                                                                           pos_(0)
+  {
+  }
+  ~kdu_growing_source() { return; } // Destructor must be virtual
+  int get_capabilities() { return KDU_SOURCE_CAP_SEQUENTIAL | KDU_SOURCE_CAP_SEEKABLE; }
+  int read(kdu_core::kdu_byte *buf, int num_bytes)
+  {
+    const size_t size = pEncoded_->size() - offset_;
+    const size_t numRead = (pos_ < size) ? std::min((size_t)num_bytes, size - pos_) : 0;
+    memcpy(buf, pEncoded_->data() + offset_ + pos_, numRead);
+    pos_ += numRead;
+    return (int)numRead;
+  }
+  bool seek(kdu_core::kdu_long offset)
+  {
+    pos_ = (offset > 0) ? (size_t)offset : 0;
+    return true;
+  }
+  kdu_core::kdu_long get_pos()
+  {
+    return (kdu_core::kdu_long)pos_;
+  }
+
+private: // Data
+  const std::vector<uint8_t> *pEncoded_;
+  size_t offset_; // of the SOC marker
+  size_t pos_;
+};
+
 /// <summary>
 /// JavaScript API for decoding HTJ2K bistreams with OpenJPH
 /// </summary>
 class HTJ2KDecoder
 {
 public:
+#ifdef __EMSCRIPTEN__
+  /// <summary>
+  /// JavaScript function called with (stripe, firstRow, numRows) where stripe is
+  /// a TypedArray view of the decoded rows in WASM memory.  The view is only
+  /// valid for the duration of the call
+  /// </summary>
+  typedef emscripten::val StripeCallback;
+#else
+  /// <summary>
+  /// Function called with the decoded rows [firstRow, firstRow + numRows) of
+  /// each stripe, stored in stripeSize bytes at pStripe.  pStripe is only
+  /// valid for the duration of the call
+  /// </summary>
+  typedef std::function<void(const uint8_t *pStripe, size_t stripeSize, size_t firstRow, size_t numRows)> StripeCallback;
+#endif
+
   /// <summary>
   /// Constructor for decoding a HTJ2K image from JavaScript.
   /// </summary>
   HTJ2KDecoder()
       : pEncoded_(&encodedInternal_),
-        pDecoded_(&decodedInternal_)
+        pDecoded_(&decodedInternal_),
+        pExternal_(NULL),
+        externalSize_(0),
+        outputFormat_(OUTPUT_NATIVE),
+        outputLayout_(LAYOUT_INTERLEAVED),
+        pSlot_(NULL),
+        isSparse_(false),
+        incrementalDecodedSize_(0),
+        maxQualityLayers_(0),
+        numDecompositions_(0),
+        isReversible_(false),
+        progressionOrder_(0),
+        isUsingColorTransform_(false),
+        isHTEnabled_(false),
+        numLayers_(0),
+        hasPLT_(false),
+        hasTLM_(false),
+        lutBitsPerSample_(0),
+        lutIsSigned_(false)
+  {
+    resetPalette();
+  }
+
+  ~HTJ2KDecoder()
   {
+    closeCodestream_();
   }
 
 #ifdef __EMSCRIPTEN__
@@ -53,8 +151,12 @@ public:
   /// </summary>
   emscripten::val getEncodedBuffer(size_t encodedSize)
   {
-    pDecoded_->resize(encodedSize);
-    return emscripten::val(emscripten::typed_memory_view(pDecoded_->size(), pDecoded_->data()));
+    closeCodestream_();
+    releaseExternal_();
+    pSlot_ = NULL;
+    isSparse_ = false;
+    pEncoded_->resize(encodedSize);
+    return emscripten::val(emscripten::typed_memory_view(pEncoded_->size(), pEncoded_->data()));
   }
 
   /// <summary>
@@ -63,6 +165,10 @@ public:
   /// </summary>
   emscripten::val getDecodedBuffer()
   {
+    if (pSlot_)
+    {
+      return emscripten::val(emscripten::typed_memory_view(pSlot_->decodedSize, pSlot_->decoded.data()));
+    }
     return emscripten::val(emscripten::typed_memory_view(pDecoded_->size(), pDecoded_->data()));
   }
 #else
@@ -72,6 +178,10 @@ public:
   /// </summary>
   std::vector<uint8_t> &getEncodedBytes()
   {
+    closeCodestream_();
+    releaseExternal_();
+    pSlot_ = NULL;
+    isSparse_ = false;
     return *pEncoded_;
   }
 
@@ -81,6 +191,10 @@ public:
   /// </summary>
   void setEncodedBytes(std::vector<uint8_t> *pEncoded)
   {
+    closeCodestream_();
+    releaseExternal_();
+    pSlot_ = NULL;
+    isSparse_ = false;
     if (pEncoded == 0)
     {
       pEncoded_ = &encodedInternal_;
@@ -91,6 +205,45 @@ public:
     }
   }
 
+  /// <summary>
+  /// Decodes from size bytes at pData instead of the encoded buffer without
+  /// copying them, e.g. a frame inside a memory mapped study or DICOM file.
+  /// The caller keeps ownership: the memory must stay valid and unchanged until
+  /// another encoded buffer is set (getEncodedBytes(), setEncodedBytes(),
+  /// setEncodedData(), setEncodedFile(), beginIncrementalDecode() or
+  /// beginSparseDecode()) or the decoder is destroyed.  Set to NULL to reset to
+  /// the encoded buffer.  This method is not exported to JavaScript, it is
+  /// intended to be called by C++ code
+  /// </summary>
+  void setEncodedData(const uint8_t *pData, size_t size)
+  {
+    closeCodestream_();
+    releaseExternal_();
+    pSlot_ = NULL;
+    isSparse_ = false;
+    pExternal_ = pData;
+    externalSize_ = pData ? size : 0;
+  }
+
+  /// <summary>
+  /// Memory maps the HTJ2K (or JP2) file at path and decodes from the mapping,
+  /// see setEncodedData().  The file is unmapped when another encoded buffer
+  /// is set or the decoder is destroyed.  This method is not exported to
+  /// JavaScript, it is intended to be called by C++ code
+  /// </summary>
+  void setEncodedFile(const char *path)
+  {
+    setEncodedData(NULL, 0);
+    mappedFile_.open(path);
+    if (mappedFile_.size() == 0)
+    {
+      mappedFile_.close();
+      throw "the file to decode is empty";
+    }
+    pExternal_ = mappedFile_.data();
+    externalSize_ = mappedFile_.size();
+  }
+
   /// <summary>
   /// Returns the buffer to store the decoded bytes.  This method is not exported
   /// to JavaScript, it is intended to be called by C++ code
@@ -119,27 +272,262 @@ public:
 #endif
 
   /// <summary>
-  /// Reads the header from an encoded HTJ2K bitstream.  The caller must have
-  /// copied the HTJ2K encoded bitstream into the encoded buffer before
-  /// calling this method, see getEncodedBuffer() and getEncodedBytes() above.
+  /// Allocates numSlots buffer slots, each with an encoded buffer of
+  /// encodedCapacity bytes and a decoded buffer of decodedCapacity bytes,
+  /// replacing any previous slots (0 releases them).  Intended for cine loops
+  /// and stack scrolling: allocate a slot per frame once, copy frame K into
+  /// slot K and decode it with selectSlot(K) followed by any of the decode
+  /// methods.  Frames that fit the capacities are then decoded without any
+  /// further allocation or zero filling of the buffers.
+  /// </summary>
+  void allocateSlots(size_t numSlots, size_t encodedCapacity, size_t decodedCapacity)
+  {
+    closeCodestream_();
+    pSlot_ = NULL;
+    isSparse_ = false;
+    slots_.clear();
+    slots_.shrink_to_fit();
+    slots_.resize(numSlots);
+    for (size_t slot = 0; slot < numSlots; slot++)
+    {
+      slots_[slot].encoded.resize(encodedCapacity);
+      slots_[slot].decoded.resize(decodedCapacity);
+    }
+  }
+
+  /// <summary>
+  /// returns the number of slots allocated by allocateSlots()
+  /// </summary>
+  size_t getNumSlots() const
+  {
+    return slots_.size();
+  }
+
+  /// <summary>
+  /// Decodes from and into the buffers of slot until another slot is selected
+  /// or the encoded buffer is accessed via getEncodedBuffer(), getEncodedBytes(),
+  /// setEncodedBytes() or beginIncrementalDecode().  getDecodedBuffer() returns
+  /// the decoded buffer of the selected slot.
+  /// </summary>
+  void selectSlot(size_t slot)
+  {
+    closeCodestream_();
+    pSlot_ = &slots_.at(slot);
+  }
+
+#ifdef __EMSCRIPTEN__
+  /// <summary>
+  /// Returns a TypedArray of encodedSize bytes of the encoded buffer of slot
+  /// for the JavaScript code to copy the encoded bitstream of a frame into.
+  /// The buffer only grows (and the heap with it) if encodedSize exceeds the
+  /// slot's capacity.
+  /// </summary>
+  emscripten::val getSlotEncodedBuffer(size_t slot, size_t encodedSize)
+  {
+    return emscripten::val(emscripten::typed_memory_view(encodedSize, setSlotEncodedSize_(slot, encodedSize)));
+  }
+
+  /// <summary>
+  /// Returns a TypedArray of the pixel data decoded into slot
+  /// </summary>
+  emscripten::val getSlotDecodedBuffer(size_t slot)
+  {
+    Slot &s = slots_.at(slot);
+    return emscripten::val(emscripten::typed_memory_view(s.decodedSize, s.decoded.data()));
+  }
+#else
+  /// <summary>
+  /// Returns the encoded buffer of slot sized to hold encodedSize bytes for the
+  /// caller to copy the encoded bitstream of a frame into.  The buffer only
+  /// grows if encodedSize exceeds the slot's capacity.  This method is not
+  /// exported to JavaScript, it is intended to be called by C++ code
+  /// </summary>
+  uint8_t *getSlotEncodedBytes(size_t slot, size_t encodedSize)
+  {
+    return setSlotEncodedSize_(slot, encodedSize);
+  }
+
+  /// <summary>
+  /// Returns the pixel data decoded into slot, see getSlotDecodedSize().  This
+  /// method is not exported to JavaScript, it is intended to be called by C++
+  /// code
+  /// </summary>
+  const uint8_t *getSlotDecodedBytes(size_t slot) const
+  {
+    return slots_.at(slot).decoded.data();
+  }
+
+  /// <summary>
+  /// returns the number of bytes decoded into slot.  This method is not
+  /// exported to JavaScript, it is intended to be called by C++ code
+  /// </summary>
+  size_t getSlotDecodedSize(size_t slot) const
+  {
+    return slots_.at(slot).decodedSize;
+  }
+#endif
+
+  /// <summary>
+  /// Sets the number of threads used to decode a single frame.  0 or 1 decodes
+  /// on the calling thread only (the default).  Values greater than 1 create
+  /// a Kakadu thread environment with that many threads (including the calling
+  /// thread) which is kept alive and reused by subsequent decodes.  For
+  /// decodeTiles() it is the number of tiles decoded in parallel instead.  Has
+  /// no effect if Kakadu was built without threading (KDU_NO_THREADS).
+  /// </summary>
+  void setNumThreads(size_t numThreads)
+  {
+    threadEnv_.setNumThreads(numThreads);
+  }
+
+  /// <summary>
+  /// returns the number of threads requested via setNumThreads()
+  /// </summary>
+  size_t getNumThreads() const
+  {
+    return threadEnv_.getNumThreads();
+  }
+
+#if !defined(__EMSCRIPTEN__) && !defined(KDU_NO_THREADS)
+  /// <summary>
+  /// Sets a caller owned Kakadu thread environment to decode with.  This allows
+  /// a single thread pool to be shared by several decoders as long as they are
+  /// all called from the thread that created the environment.  The environment
+  /// takes precedence over setNumThreads().  Set to 0 to stop using it.  This
+  /// method is not exported to JavaScript, it is intended to be called by C++ code
+  /// </summary>
+  void setThreadEnv(kdu_core::kdu_thread_env *pThreadEnv)
+  {
+    threadEnv_.setExternal(pThreadEnv);
+  }
+#endif
+
+  /// <summary>
+  /// Sets the maximum number of quality layers used by the decode methods.
+  /// 0 decodes all layers (the default).  Decoding only the first layer(s) of
+  /// a multi-layer bitstream is a fast way to produce a preview since the code
+  /// block passes of the discarded layers are never decoded.  See
+  /// getNumLayers() for the number of layers in the bitstream.
+  /// </summary>
+  void setMaxQualityLayers(size_t maxQualityLayers)
+  {
+    maxQualityLayers_ = maxQualityLayers;
+  }
+
+  /// <summary>
+  /// returns the maximum number of quality layers decoded, 0 = all
+  /// </summary>
+  size_t getMaxQualityLayers() const
+  {
+    return maxQualityLayers_;
+  }
+
+  /// <summary>
+  /// Sets the sample format of the decoded buffer for the following decode
+  /// calls.  With OUTPUT_RGBA the stripe decompressor writes the red, green
+  /// and blue samples of a three component image straight into RGBA pixels,
+  /// grayscale is expanded with the palette (after the VOI for decodeVOI()).
+  /// Samples deeper than 8 bits are reduced to their 8 most significant bits
+  /// unless a VOI is used.  FrameInfo reports 4 components of 8 unsigned bits
+  /// after the decode so the decoded buffer can be handed to putImageData() or
+  /// a texture upload as is.
+  /// </summary>
+  void setOutputFormat(OutputFormat outputFormat)
+  {
+    outputFormat_ = outputFormat;
+  }
+
+  /// <summary>
+  /// returns the sample format of the decoded buffer
+  /// </summary>
+  OutputFormat getOutputFormat() const
+  {
+    return outputFormat_;
+  }
+
+  /// <summary>
+  /// Sets how the components are arranged in the decoded buffer for the
+  /// following decode calls.  LAYOUT_PLANAR stores each component as a
+  /// separate plane of getComponentSize() samples, which also supports
+  /// subsampled components.  The stripe decompressor writes the planes
+  /// directly so no deinterleaving pass is needed.  Ignored for RGBA and VOI
+  /// output and not supported by decodeStripes().
+  /// </summary>
+  void setOutputLayout(OutputLayout outputLayout)
+  {
+    outputLayout_ = outputLayout;
+  }
+
+  /// <summary>
+  /// returns how the components are arranged in the decoded buffer
+  /// </summary>
+  OutputLayout getOutputLayout() const
+  {
+    return outputLayout_;
+  }
+
+#ifdef __EMSCRIPTEN__
+  /// <summary>
+  /// returns a TypedArray of the 256 entry RGBA palette (1024 bytes) used to
+  /// expand grayscale for OUTPUT_RGBA.  JavaScript code may overwrite it with
+  /// a color map
+  /// </summary>
+  emscripten::val getPaletteBuffer()
+  {
+    return emscripten::val(emscripten::typed_memory_view(palette_.size(), palette_.data()));
+  }
+#else
+  /// <summary>
+  /// returns the 256 entry RGBA palette (1024 bytes) used to expand grayscale
+  /// for OUTPUT_RGBA.  The size must not be changed.  This method is not
+  /// exported to JavaScript, it is intended to be called by C++ code
+  /// </summary>
+  std::vector<uint8_t> &getPaletteBytes()
+  {
+    return palette_;
+  }
+#endif
+
+  /// <summary>
+  /// Restores the palette to an opaque grayscale ramp
+  /// </summary>
+  void resetPalette()
+  {
+    palette_.resize(256 * 4);
+    for (size_t i = 0; i < 256; i++)
+    {
+      palette_[i * 4] = palette_[i * 4 + 1] = palette_[i * 4 + 2] = (uint8_t)i;
+      palette_[i * 4 + 3] = 255;
+    }
+  }
+
+  /// <summary>
+  /// Reads the header from an encoded HTJ2K bitstream and populates FrameInfo
+  /// and all of the coding parameters (see the getters below).  Only the main
+  /// header is parsed, no tile data is read.  The parsed codestream is kept so
+  /// the next decode call reuses it instead of parsing the header again.  It is
+  /// discarded if the encoded buffer is accessed via getEncodedBuffer(),
+  /// getEncodedBytes() or setEncodedBytes().  The caller must have copied the
+  /// HTJ2K encoded bitstream into the encoded buffer before calling this
+  /// method, see getEncodedBuffer() and getEncodedBytes() above.
   /// </summary>
   void readHeader()
   {
-    kdu_core::kdu_compressed_source_buffered input(pEncoded_->data(), pEncoded_->size());
-    kdu_core::kdu_codestream codestream;
-    readHeader_(codestream, input);
-    codestream.destroy();
-    input.close();
+    stats_.begin("readHeader");
+    closeCodestream_();
+    openCodestream_();
+    stats_.lap(stats_.stats().headerMs, "header");
+    stats_.end();
   }
 
   /// <summary>
   /// Calculates the resolution for a given decomposition level based on the
-  /// current values in FrameInfo (which is populated via readHeader() and
+  /// full resolution size of the image (which is populated via readHeader() and
   /// decode()).  level = 0 = full res, level = _numDecompositions = lowest resolution
   /// </summary>
   Size calculateSizeAtDecompositionLevel(int decompositionLevel)
   {
-    Size result(frameInfo_.width, frameInfo_.height);
+    Size result = fullResolution_;
     while (decompositionLevel > 0)
     {
       result.width = ojph_div_ceil(result.width, 2);
@@ -156,201 +544,1353 @@ public:
   /// </summary>
   void decode()
   {
-    kdu_core::kdu_codestream codestream;
-    kdu_core::kdu_compressed_source_buffered input(pEncoded_->data(), pEncoded_->size());
-    readHeader_(codestream, input);
-    decode_(codestream, input, 0);
-    codestream.destroy();
-    input.close();
+    decode_(0, NULL);
+  }
+
+#ifndef __EMSCRIPTEN__
+  /// <summary>
+  /// Decodes size bytes at pData without copying them, see setEncodedData().
+  /// This method is not exported to JavaScript, it is intended to be called
+  /// by C++ code
+  /// </summary>
+  void decode(const uint8_t *pData, size_t size)
+  {
+    setEncodedData(pData, size);
+    decode();
+  }
+
+  /// <summary>
+  /// Memory maps the file at path and decodes it, see setEncodedFile().  This
+  /// method is not exported to JavaScript, it is intended to be called by C++
+  /// code
+  /// </summary>
+  void decodeFile(const char *path)
+  {
+    setEncodedFile(path);
+    decode();
   }
+#endif
 
   /// <summary>
   /// Decodes the encoded HTJ2K bitstream to the requested decomposition level.
-  /// The caller must have copied the HTJ2K encoded bitstream into the encoded
-  /// buffer before calling this method, see getEncodedBuffer() and
-  ///  getEncodedBytes() above.
+  /// The discarded resolution levels are never decoded so each level roughly
+  /// quarters the decoding cost.  The width and height in FrameInfo and the
+  /// size of the decoded buffer reflect the reduced resolution, see
+  /// calculateSizeAtDecompositionLevel().  The caller must have copied the
+  /// HTJ2K encoded bitstream into the encoded buffer before calling this
+  /// method, see getEncodedBuffer() and getEncodedBytes() above.
   /// </summary>
   void decodeSubResolution(size_t decompositionLevel)
   {
-    kdu_core::kdu_codestream codestream;
-    kdu_core::kdu_compressed_source_buffered input(pEncoded_->data(), pEncoded_->size());
-    readHeader_(codestream, input);
-    decode_(codestream, input, decompositionLevel);
-    codestream.destroy();
-    input.close();
+    decode_(decompositionLevel, NULL);
   }
 
   /// <summary>
-  /// returns the FrameInfo object for the decoded image.
+  /// Decodes a tiled image to the requested decomposition level by decoding
+  /// up to getNumThreads() tiles concurrently, each with its own codestream,
+  /// directly into its region of the decoded buffer.  Unlike decode(), which
+  /// shares one Kakadu thread environment across the tiles, this scales with
+  /// the number of tiles but uses one codestream per worker, so it is opt-in.
+  /// It requires native interleaved output.  The result is identical to
+  /// decodeSubResolution().  The caller must have
+  /// copied the HTJ2K encoded bitstream into the encoded buffer before calling
+  /// this method, see getEncodedBuffer() and getEncodedBytes() above.
   /// </summary>
-  const FrameInfo &getFrameInfo() const
+  void decodeTiles(size_t decompositionLevel)
   {
-    return frameInfo_;
+    stats_.begin("decodeTiles");
+    openCodestream_();
+    stats_.lap(stats_.stats().headerMs, "header");
+    if (decompositionLevel > (size_t)codestream_.get_min_dwt_levels())
+    {
+      closeCodestream_();
+      throw "decompositionLevel exceeds the number of wavelet decompositions";
+    }
+    if (outputFormat_ != OUTPUT_NATIVE || outputLayout_ != LAYOUT_INTERLEAVED)
+    {
+      closeCodestream_();
+      throw "decodeTiles() requires native interleaved output";
+    }
+    codestream_.apply_input_restrictions(0, frameInfo_.componentCount, (int)decompositionLevel, (int)maxQualityLayers_, NULL);
+    kdu_core::kdu_dims image;
+    codestream_.get_dims(0, image);
+    for (size_t c = 1; c < frameInfo_.componentCount; c++)
+    {
+      kdu_core::kdu_dims componentDims;
+      codestream_.get_dims((int)c, componentDims);
+      if (componentDims.size != image.size)
+      {
+        closeCodestream_();
+        throw "interleaved output requires components of the same size, see setOutputLayout()";
+      }
+    }
+    closeCodestream_();
+    frameInfo_.width = image.size.x;
+    frameInfo_.height = image.size.y;
+    componentSizes_.assign(frameInfo_.componentCount, Size(image.size.x, image.size.y));
+
+    const size_t bytesPerSample = (frameInfo_.bitsPerSample + 8 - 1) / 8;
+    const size_t rowSize = kdu_core::kdu_memsafe_mul(frameInfo_.componentCount,
+                                                     kdu_core::kdu_memsafe_mul(frameInfo_.width, bytesPerSample));
+    uint8_t *output = allocateDecoded_(kdu_core::kdu_memsafe_mul(frameInfo_.height, rowSize));
+    stats_.lap(stats_.stats().startMs, "start");
+
+    std::atomic<size_t> nextTile(0);
+    size_t numWorkers = 1;
+#ifndef KDU_NO_THREADS
+    const size_t numTiles = (size_t)numTiles_.width * numTiles_.height;
+    numWorkers = std::max(std::min(threadEnv_.getNumThreads(), numTiles), (size_t)1);
+#endif
+    std::vector<std::exception_ptr> errors(numWorkers);
+#ifndef KDU_NO_THREADS
+    std::vector<std::thread> workers;
+    for (size_t worker = 1; worker < numWorkers; worker++)
+    {
+      workers.push_back(std::thread(&HTJ2KDecoder::decodeTilesWorker_, this, decompositionLevel, image,
+                                    output, rowSize, std::ref(nextTile), &errors[worker]));
+    }
+#endif
+    decodeTilesWorker_(decompositionLevel, image, output, rowSize, nextTile, &errors[0]);
+#ifndef KDU_NO_THREADS
+    for (size_t worker = 0; worker < workers.size(); worker++)
+    {
+      workers[worker].join();
+    }
+#endif
+    for (size_t worker = 0; worker < numWorkers; worker++)
+    {
+      if (errors[worker])
+      {
+        std::rethrow_exception(errors[worker]);
+      }
+    }
+    stats_.lap(stats_.stats().processMs, "tiles");
+    stats_.end();
   }
 
   /// <summary>
-  /// returns the number of wavelet decompositions.
+  /// Decodes a single tile, in raster order from 0 to the number of tiles
+  /// (see getNumTiles()), to the requested decomposition level.  Only the
+  /// code-blocks of that tile are decoded.  The width and height in FrameInfo
+  /// and the size of the decoded buffer reflect the tile at the requested
+  /// resolution.  The caller must have copied the HTJ2K encoded bitstream into
+  /// the encoded buffer before calling this method, see getEncodedBuffer() and
+  /// getEncodedBytes() above.
   /// </summary>
-  const size_t getNumDecompositions() const
+  void decodeTile(size_t tileIndex, size_t decompositionLevel)
   {
-    return numDecompositions_;
+    openCodestream_();
+    if (tileIndex >= (size_t)numTiles_.width * numTiles_.height)
+    {
+      closeCodestream_();
+      throw "tileIndex exceeds the number of tiles";
+    }
+    kdu_core::kdu_dims region = getTileRegion_(codestream_, tileIndex);
+    decode_(decompositionLevel, &region);
   }
 
   /// <summary>
-  /// returns true if the image is lossless, false if lossy
+  /// Decodes a rectangular region of the encoded HTJ2K bitstream at the
+  /// requested decomposition level.  The region is specified in full resolution
+  /// image coordinates and is clipped to the image.  Only the code-blocks and
+  /// precincts that contribute to the region are decoded.  The width and height
+  /// in FrameInfo and the size of the decoded buffer reflect the decoded region
+  /// at the requested resolution.  The caller must have copied the HTJ2K
+  /// encoded bitstream into the encoded buffer before calling this method, see
+  /// getEncodedBuffer() and getEncodedBytes() above.
   /// </summary>
-  const bool getIsReversible() const
+  void decodeRegion(size_t x, size_t y, size_t width, size_t height, size_t decompositionLevel)
   {
-    return isReversible_;
+    openCodestream_();
+
+    // convert the region from image to canvas coordinates
+    kdu_core::kdu_dims image;
+    codestream_.get_dims(-1, image);
+    kdu_core::kdu_dims region;
+    region.pos = image.pos + kdu_core::kdu_coords((int)x, (int)y);
+    region.size = kdu_core::kdu_coords((int)width, (int)height);
+    region &= image;
+    if (region.is_empty())
+    {
+      closeCodestream_();
+      throw "region does not intersect the image";
+    }
+
+    decode_(decompositionLevel, &region);
   }
 
   /// <summary>
-  /// returns progression order.
-  // 0 = LRCP
-  // 1 = RLCP
-  // 2 = RPCL
-  // 3 = PCRL
-  // 4 = CPRL
+  /// Decodes the encoded HTJ2K bitstream to the requested decomposition level
+  /// in stripes of stripeHeight rows.  Each stripe is handed to callback before
+  /// the next one is decoded so the memory used is bounded by the stripe size
+  /// rather than the image size.  The decoded buffer is not used.  FrameInfo is
+  /// populated before the first callback.  The caller must have copied the
+  /// HTJ2K encoded bitstream into the encoded buffer before calling this
+  /// method, see getEncodedBuffer() and getEncodedBytes() above.
   /// </summary>
-  const size_t getProgressionOrder() const
+  void decodeStripes(size_t decompositionLevel, size_t stripeHeight, StripeCallback callback)
   {
-    return progressionOrder_;
+    decode_(decompositionLevel, NULL, stripeHeight, &callback);
   }
 
   /// <summary>
-  /// returns the down sampling used for component.
+  /// Decodes the encoded HTJ2K bitstream to the requested decomposition level
+  /// and maps the samples to 8 bits for display with the rescale slope /
+  /// intercept and VOI window in voi.  The mapping is applied by a lookup
+  /// table to each stripe as it is decoded so the full bit depth image is never
+  /// stored and the decoded buffer holds one byte per pixel.  FrameInfo reports
+  /// 8 unsigned bits per sample after the call.  Only single component images
+  /// are supported.  The caller must have copied the HTJ2K encoded bitstream
+  /// into the encoded buffer before calling this method, see
+  /// getEncodedBuffer() and getEncodedBytes() above.
   /// </summary>
-  Point getDownSample(size_t component) const
+  void decodeVOI(size_t decompositionLevel, const VOI &voi)
   {
-    return downSamples_[component];
+    decode_(decompositionLevel, NULL, 0, NULL, &voi);
   }
 
   /// <summary>
-  /// returns the block dimensions
+  /// Starts an incremental decode session for an encoded HTJ2K bitstream that
+  /// is received in chunks (e.g. over the network).  Clears the encoded buffer
+  /// and reserves expectedSize bytes for it (0 if unknown) so appending does not
+  /// need to reallocate.  Chunks are then added with appendEncodedBuffer() /
+  /// appendEncodedBytes() and decodeIncremental() produces a best effort decode
+  /// of the bytes received so far.
   /// </summary>
-  Size getBlockDimensions() const
+  void beginIncrementalDecode(size_t expectedSize)
   {
-    return blockDimensions_;
+    closeCodestream_();
+    releaseExternal_();
+    pSlot_ = NULL;
+    isSparse_ = false;
+    pEncoded_->clear();
+    pEncoded_->reserve(expectedSize);
+    incrementalDecodedSize_ = 0;
   }
 
+#ifdef __EMSCRIPTEN__
   /// <summary>
-  /// returns whether or not a color transform is used
+  /// Grows the encoded buffer by chunkSize bytes and returns a TypedArray of the
+  /// new bytes at the end of the buffer.  JavaScript code needs to copy the next
+  /// chunk of the HTJ2K encoded bitstream into the returned TypedArray.  The
+  /// bytes received previously are kept, see beginIncrementalDecode().
   /// </summary>
-  bool getIsUsingColorTransform() const
+  emscripten::val appendEncodedBuffer(size_t chunkSize)
   {
-    return isUsingColorTransform_;
+    closeNonIncremental_();
+    const size_t size = pEncoded_->size();
+    pEncoded_->resize(size + chunkSize);
+    return emscripten::val(emscripten::typed_memory_view(chunkSize, pEncoded_->data() + size));
   }
-
+#else
   /// <summary>
-  /// returns whether or not HT encoding was used
+  /// Appends the next chunk of the HTJ2K encoded bitstream to the encoded
+  /// buffer, see beginIncrementalDecode().  This method is not exported to
+  /// JavaScript, it is intended to be called by C++ code
   /// </summary>
-  bool getIsHTEnabled() const
+  void appendEncodedBytes(const uint8_t *pChunk, size_t chunkSize)
   {
-    return isHTEnabled_;
+    closeNonIncremental_();
+    pEncoded_->insert(pEncoded_->end(), pChunk, pChunk + chunkSize);
   }
+#endif
 
-private:
-  void readHeader_(kdu_core::kdu_codestream &codestream, kdu_core::kdu_compressed_source_buffered &source)
+  /// <summary>
+  /// Decodes as much of the image as possible from the bytes received so far in
+  /// an incremental decode session, see beginIncrementalDecode().  Missing
+  /// packets are treated as empty so the image is refined as more of the
+  /// bitstream arrives.  Returns false without decoding if the main header has
+  /// not been received yet or no bytes were appended since the last call, in
+  /// which case the decoded buffer still holds the previous result.  The
+  /// codestream stays open between calls: the main header is parsed once and
+  /// later calls restart it over the grown buffer, reusing its structures.
+  /// </summary>
+  bool decodeIncremental(size_t decompositionLevel)
   {
-    kdu_supp::jp2_family_src jp2_ultimate_src;
-    jp2_ultimate_src.open(&source);
-    kdu_supp::jpx_source jpx_in;
-    if (jpx_in.open(&jp2_ultimate_src, true) < 0)
+    if (pEncoded_->size() == incrementalDecodedSize_ || !hasMainHeader_())
     {
-      jp2_ultimate_src.close();
-      source.seek(-source.get_pos()); // rewind the source to the first byte since jp2_family_src moved it forward
+      return false;
     }
-    else
+    incrementalDecodedSize_ = pEncoded_->size();
+    try
     {
-      // move to the first compositing layer
-      kdu_supp::jpx_layer_source jpx_layer = jpx_in.access_layer(0);
+      if (!pIncrementalSource_)
+      {
+        closeCodestream_();
+        pIncrementalSource_.reset(new kdu_growing_source(*pEncoded_, findCodestream_()));
+        readHeader_(codestream_, *pIncrementalSource_);
+      }
+      else
+      {
+        // the source reports the bytes appended since the last call.  The
+        // output format of the previous decode may have changed frameInfo_
+        pIncrementalSource_->seek(0);
+        codestream_.restart(pIncrementalSource_.get());
+        frameInfo_.componentCount = codestream_.get_num_components();
+        frameInfo_.bitsPerSample = codestream_.get_bit_depth(0);
+        frameInfo_.isSigned = codestream_.get_signed(0);
+      }
+      codestream_.set_persistent();
+      codestream_.set_resilient();
     }
-
-    // Create the codestream object.
-    codestream.create(&source);
-
-    // Determine number of components to decompress
-    kdu_core::kdu_dims dims;
-    codestream.get_dims(0, dims);
-
-    int num_components = codestream.get_num_components();
-    if (num_components == 2)
-      num_components = 1;
-    else if (num_components >= 3)
-    { // Check that components have consistent dimensions
-      num_components = 3;
-      kdu_core::kdu_dims dims1;
-      codestream.get_dims(1, dims1);
-      kdu_core::kdu_dims dims2;
-      codestream.get_dims(2, dims2);
-      if ((dims1 != dims) || (dims2 != dims))
-        num_components = 1;
+    catch (...)
+    {
+      closeCodestream_();
+      throw;
     }
-    codestream.apply_input_restrictions(0, num_components, 0, 0, NULL);
-    frameInfo_.width = dims.size.x;
-    frameInfo_.height = dims.size.y;
-    frameInfo_.componentCount = num_components;
-    frameInfo_.bitsPerSample = codestream.get_bit_depth(0);
-    frameInfo_.isSigned = codestream.get_signed(0);
+    decode_(decompositionLevel, NULL);
+    return true;
   }
 
-  void decode_(kdu_core::kdu_codestream &codestream, kdu_core::kdu_compressed_source_buffered &input, size_t decompositionLevel)
+  /// <summary>
+  /// Returns the byte ranges of the encoded bitstream needed to decode the
+  /// region (x, y, width, height in full resolution image coordinates, width
+  /// or height 0 for the whole image) at decompositionLevel with numLayers
+  /// quality layers (0 = all).  The main and tile-part headers including
+  /// TLM/PLT markers are parsed to skip the tiles outside the region and the
+  /// packets of the discarded resolutions and layers where the progression
+  /// order allows, see CodestreamIndex.  If header bytes needed to plan are
+  /// missing from a sparse encoded buffer (see beginSparseDecode()) the
+  /// result includes the header bytes to fetch next, so callers repeat until
+  /// getMissingByteRanges() returns nothing.
+  /// </summary>
+  std::vector<ByteRange> getByteRanges(size_t decompositionLevel, size_t x, size_t y, size_t width, size_t height, size_t numLayers) const
   {
+    std::vector<ByteRange> ranges;
+    CodestreamIndex index(getEncodedData_(), getEncodedSize_(), getSparseFilled_());
+    index.plan(decompositionLevel, x, y, width, height, numLayers, ranges);
+    CodestreamIndex::merge(ranges);
+    return ranges;
+  }
+
+  /// <summary>
+  /// Returns the ranges of getByteRanges() that have not been copied into the
+  /// sparse encoded buffer yet.  Empty once the sparse encoded buffer can be
+  /// decoded with the same parameters (decodeSubResolution() or decodeRegion()
+  /// after setMaxQualityLayers(numLayers)).
+  /// </summary>
+  std::vector<ByteRange> getMissingByteRanges(size_t decompositionLevel, size_t x, size_t y, size_t width, size_t height, size_t numLayers) const
+  {
+    const std::vector<ByteRange> ranges = getByteRanges(decompositionLevel, x, y, width, height, numLayers);
+    const std::vector<ByteRange> *pFilled = getSparseFilled_();
+    return pFilled ? CodestreamIndex::subtract(ranges, *pFilled) : std::vector<ByteRange>();
+  }
+
+  /// <summary>
+  /// Starts a sparse decode session for an encoded bitstream of fileSize bytes
+  /// that is fetched in ranges (e.g. HTTP range requests), see
+  /// getMissingByteRanges().  The encoded buffer is resized to fileSize and
+  /// zero filled, the ranges are then copied in at their offsets with
+  /// getSparseEncodedBuffer() / setSparseEncodedBytes().  Bytes that are never
+  /// fetched read as empty packets.
+  /// </summary>
+  void beginSparseDecode(size_t fileSize)
+  {
+    closeCodestream_();
+    releaseExternal_();
+    pSlot_ = NULL;
+    pEncoded_->assign(fileSize, 0);
+    sparseFilled_.clear();
+    isSparse_ = true;
+  }
+
+#ifdef __EMSCRIPTEN__
+  /// <summary>
+  /// Returns a TypedArray of length bytes at offset of the sparse encoded
+  /// buffer and records the range as received.  JavaScript code needs to copy
+  /// the fetched bytes into it, see beginSparseDecode().
+  /// </summary>
+  emscripten::val getSparseEncodedBuffer(size_t offset, size_t length)
+  {
+    addSparseRange_(offset, length);
+    return emscripten::val(emscripten::typed_memory_view(length, pEncoded_->data() + offset));
+  }
+#else
+  /// <summary>
+  /// Copies length fetched bytes to offset of the sparse encoded buffer and
+  /// records the range as received, see beginSparseDecode().  This method is
+  /// not exported to JavaScript, it is intended to be called by C++ code
+  /// </summary>
+  void setSparseEncodedBytes(size_t offset, const uint8_t *pData, size_t length)
+  {
+    addSparseRange_(offset, length);
+    std::copy(pData, pData + length, pEncoded_->begin() + offset);
+  }
+#endif
+
+  /// <summary>
+  /// returns the FrameInfo object for the decoded image.  After
+  /// decodeSubResolution() the width and height are those of the decoded
+  /// resolution rather than the full resolution image.
+  /// </summary>
+  const FrameInfo &getFrameInfo() const
+  {
+    return frameInfo_;
+  }
+
+  /// <summary>
+  /// returns the number of wavelet decompositions.
+  /// </summary>
+  const size_t getNumDecompositions() const
+  {
+    return numDecompositions_;
+  }
+
+  /// <summary>
+  /// returns true if the image is lossless, false if lossy
+  /// </summary>
+  const bool getIsReversible() const
+  {
+    return isReversible_;
+  }
+
+  /// <summary>
+  /// returns progression order.
+  // 0 = LRCP
+  // 1 = RLCP
+  // 2 = RPCL
+  // 3 = PCRL
+  // 4 = CPRL
+  /// </summary>
+  const size_t getProgressionOrder() const
+  {
+    return progressionOrder_;
+  }
+
+  /// <summary>
+  /// returns the down sampling used for component.
+  /// </summary>
+  Point getDownSample(size_t component) const
+  {
+    return downSamples_[component];
+  }
+
+  /// <summary>
+  /// returns the width and height of a component in the decoded buffer, which
+  /// is smaller than FrameInfo for subsampled components.  Reflects the last
+  /// decode (or the full resolution after readHeader())
+  /// </summary>
+  Size getComponentSize(size_t component) const
+  {
+    return componentSizes_.at(component);
+  }
+
+  /// <summary>
+  /// returns the block dimensions
+  /// </summary>
+  Size getBlockDimensions() const
+  {
+    return blockDimensions_;
+  }
+
+  /// <summary>
+  /// returns whether or not a color transform is used
+  /// </summary>
+  bool getIsUsingColorTransform() const
+  {
+    return isUsingColorTransform_;
+  }
+
+  /// <summary>
+  /// returns whether or not HT encoding was used
+  /// </summary>
+  bool getIsHTEnabled() const
+  {
+    return isHTEnabled_;
+  }
+
+  /// <summary>
+  /// returns the number of quality layers
+  /// </summary>
+  size_t getNumLayers() const
+  {
+    return numLayers_;
+  }
+
+  /// <summary>
+  /// returns the nominal tile size (the full image size if not tiled)
+  /// </summary>
+  Size getTileSize() const
+  {
+    return tileSize_;
+  }
+
+  /// <summary>
+  /// returns the number of tiles across and down the image
+  /// </summary>
+  Size getNumTiles() const
+  {
+    return numTiles_;
+  }
+
+  /// <summary>
+  /// returns the precinct dimensions for a decomposition level (the first
+  /// component/tile). level = 0 = full res, level = _numDecompositions = lowest resolution
+  /// </summary>
+  Size getPrecinctSize(size_t decompositionLevel) const
+  {
+    if (decompositionLevel >= precinctSizes_.size())
+    {
+      throw "decomposition level out of range";
+    }
+    return precinctSizes_[decompositionLevel];
+  }
+
+  /// <summary>
+  /// returns whether the codestream has PLT (packet length) marker segments
+  /// so packets can be located without parsing the packet headers
+  /// </summary>
+  bool getHasPLT() const
+  {
+    return hasPLT_;
+  }
+
+  /// <summary>
+  /// returns whether the codestream has a TLM (tile part length) marker
+  /// segment so tiles can be located without walking the tile parts
+  /// </summary>
+  bool getHasTLM() const
+  {
+    return hasTLM_;
+  }
+
+  /// <summary>
+  /// Enables recording statistics for each readHeader() and decode call, see
+  /// getStats().  Disabled by default, the overhead when disabled is a branch
+  /// per decode phase
+  /// </summary>
+  void setStatsEnabled(bool enabled)
+  {
+    stats_.setEnabled(enabled);
+  }
+
+  /// <summary>
+  /// Enables collecting Chrome trace events for every call while statistics
+  /// are enabled, see getTraceJson()
+  /// </summary>
+  void setTraceEnabled(bool enabled)
+  {
+    stats_.setTraceEnabled(enabled);
+  }
+
+  /// <summary>
+  /// returns the statistics of the last readHeader() or decode call, see
+  /// setStatsEnabled()
+  /// </summary>
+  Stats getStats() const
+  {
+    return stats_.getStats();
+  }
+
+  /// <summary>
+  /// returns the trace events collected since the last clearTrace() as Chrome
+  /// trace event JSON (load it in chrome://tracing or Perfetto)
+  /// </summary>
+  std::string getTraceJson() const
+  {
+    return stats_.getTraceJson();
+  }
+
+  /// <summary>
+  /// discards the collected trace events
+  /// </summary>
+  void clearTrace()
+  {
+    stats_.clearTrace();
+  }
+
+private:
+  // the largest componentCount FrameInfo can describe
+  static const size_t maxComponents_ = 255;
+
+  // A pair of encoded and decoded buffers, see allocateSlots().  The buffers
+  // are kept at their capacity and the sizes of their contents tracked
+  // separately so reusing them never zero fills
+  struct Slot
+  {
+    Slot() : encodedSize(0), decodedSize(0) {}
+
+    std::vector<uint8_t> encoded;
+    size_t encodedSize;
+    std::vector<uint8_t> decoded;
+    size_t decodedSize;
+  };
+
+  uint8_t *setSlotEncodedSize_(size_t slot, size_t encodedSize)
+  {
+    Slot &s = slots_.at(slot);
+    if (pSlot_ == &s)
+    {
+      closeCodestream_();
+    }
+    if (s.encoded.size() < encodedSize)
+    {
+      s.encoded.resize(encodedSize);
+    }
+    s.encodedSize = encodedSize;
+    return s.encoded.data();
+  }
+
+  // the ranges of a sparse encoded buffer received so far, NULL if the whole
+  // encoded buffer is valid
+  const std::vector<ByteRange> *getSparseFilled_() const
+  {
+    return (isSparse_ && !pSlot_) ? &sparseFilled_ : NULL;
+  }
+
+  void addSparseRange_(size_t offset, size_t length)
+  {
+    if (!isSparse_ || offset + length > pEncoded_->size())
+    {
+      throw "the range is outside of the sparse encoded buffer, see beginSparseDecode()";
+    }
+    closeCodestream_();
+    pSlot_ = NULL;
+    sparseFilled_.push_back(ByteRange(offset, length));
+    CodestreamIndex::merge(sparseFilled_);
+  }
+
+  // the encoded bitstream, either in the selected slot, caller owned memory
+  // (see setEncodedData()) or the encoded buffer
+  const uint8_t *getEncodedData_() const
+  {
+    if (pSlot_)
+    {
+      return pSlot_->encoded.data();
+    }
+    return pExternal_ ? pExternal_ : pEncoded_->data();
+  }
+
+  size_t getEncodedSize_() const
+  {
+    if (pSlot_)
+    {
+      return pSlot_->encodedSize;
+    }
+    return pExternal_ ? externalSize_ : pEncoded_->size();
+  }
+
+  // stops decoding from caller owned memory or a mapped file.  The codestream
+  // must be closed first as its source reads from them
+  void releaseExternal_()
+  {
+    pExternal_ = NULL;
+    externalSize_ = 0;
+#ifndef __EMSCRIPTEN__
+    mappedFile_.close();
+#endif
+  }
+
+  // returns the buffer to decode size bytes into, either in the selected slot
+  // or the decoded buffer
+  uint8_t *allocateDecoded_(size_t size)
+  {
+    std::vector<uint8_t> &decoded = pSlot_ ? pSlot_->decoded : *pDecoded_;
+    const size_t capacity = decoded.capacity();
+    if (!pSlot_ || decoded.size() < size)
+    {
+      decoded.resize(size);
+    }
+    if (pSlot_)
+    {
+      pSlot_->decodedSize = size;
+    }
+    stats_.buffer(capacity, decoded.capacity(), size);
+    return decoded.data();
+  }
+
+  // returns the offset of the SOC marker, see CodestreamIndex::findCodestream()
+  size_t findCodestream_() const
+  {
+    return CodestreamIndex::findCodestream(getEncodedData_(), getEncodedSize_());
+  }
+
+  // records whether the main header has a TLM marker segment and the first
+  // tile part header has PLT marker segments.  Kakadu uses them internally
+  // but does not report their presence
+  void scanPointerMarkers_()
+  {
+    const uint8_t *data = getEncodedData_();
+    const size_t size = getEncodedSize_();
+    hasTLM_ = false;
+    hasPLT_ = false;
+    size_t offset = findCodestream_() + 2;
+    while (offset + 4 <= size && data[offset] == 0xFF && data[offset + 1] != 0x93) // SOD
+    {
+      if (data[offset + 1] == 0x55) // TLM
+      {
+        hasTLM_ = true;
+      }
+      else if (data[offset + 1] == 0x58) // PLT
+      {
+        hasPLT_ = true;
+      }
+      offset += 2 + ((data[offset + 2] << 8) | data[offset + 3]);
+    }
+  }
+
+  // returns true if the encoded buffer contains the complete main header,
+  // i.e. the marker segments following SOC up to the first SOT marker.  Used
+  // to avoid handing Kakadu a header it cannot parse yet
+  bool hasMainHeader_() const
+  {
+    const uint8_t *data = getEncodedData_();
+    const size_t size = getEncodedSize_();
+    size_t offset = findCodestream_() + 2;
+    while (offset + 4 <= size)
+    {
+      if (data[offset] != 0xFF)
+      {
+        return false;
+      }
+      if (data[offset + 1] == 0x90) // SOT
+      {
+        return true;
+      }
+      offset += 2 + ((data[offset + 2] << 8) | data[offset + 3]);
+    }
+    return false;
+  }
+
+  void openCodestream_()
+  {
+    if (codestream_.exists())
+    {
+      return;
+    }
+    pSource_.reset(new kdu_core::kdu_compressed_source_buffered((kdu_core::kdu_byte *)getEncodedData_(), getEncodedSize_()));
+    try
+    {
+      readHeader_(codestream_, *pSource_);
+    }
+    catch (...)
+    {
+      closeCodestream_();
+      throw;
+    }
+  }
+
+  void closeCodestream_()
+  {
+    if (codestream_.exists())
+    {
+      codestream_.destroy();
+    }
+    if (pSource_)
+    {
+      pSource_->close();
+      pSource_.reset();
+    }
+    pIncrementalSource_.reset();
+  }
+
+  // closes the codestream unless it reads from the growing encoded buffer of
+  // an incremental decode session, which must stay open across appends
+  void closeNonIncremental_()
+  {
+    if (!pIncrementalSource_)
+    {
+      closeCodestream_();
+    }
+  }
+
+  void readHeader_(kdu_core::kdu_codestream &codestream, kdu_core::kdu_compressed_source &source)
+  {
+    kdu_supp::jp2_family_src jp2_ultimate_src;
+    jp2_ultimate_src.open(&source);
+    kdu_supp::jpx_source jpx_in;
+    if (jpx_in.open(&jp2_ultimate_src, true) < 0)
+    {
+      jp2_ultimate_src.close();
+      source.seek(-source.get_pos()); // rewind the source to the first byte since jp2_family_src moved it forward
+    }
+    else
+    {
+      // move to the first compositing layer
+      kdu_supp::jpx_layer_source jpx_layer = jpx_in.access_layer(0);
+    }
+
+    // Create the codestream object.  This only parses the main header, tile
+    // headers and data are not read until the tiles are opened by decode_()
+    codestream.create(&source);
+
+    // Determine number of components to decompress
+    kdu_core::kdu_dims dims;
+    codestream.get_dims(0, dims);
+
+    // all components are decoded, subsampled ones at their own size (see
+    // getComponentSize())
+    int num_components = codestream.get_num_components();
+    if (num_components > (int)maxComponents_)
+    {
+      throw "images with more than 255 components are not supported";
+    }
+    codestream.apply_input_restrictions(0, num_components, 0, 0, NULL);
+    fullResolution_ = Size(dims.size.x, dims.size.y);
+    frameInfo_.width = dims.size.x;
+    frameInfo_.height = dims.size.y;
+    frameInfo_.componentCount = num_components;
+    frameInfo_.bitsPerSample = codestream.get_bit_depth(0);
+    frameInfo_.isSigned = codestream.get_signed(0);
+
+    downSamples_.resize(num_components);
+    componentSizes_.resize(num_components);
+    for (int c = 0; c < num_components; c++)
+    {
+      kdu_core::kdu_coords subsampling;
+      codestream.get_subsampling(c, subsampling);
+      downSamples_[c] = Point(subsampling.x, subsampling.y);
+      kdu_core::kdu_dims componentDims;
+      codestream.get_dims(c, componentDims);
+      componentSizes_[c] = Size(componentDims.size.x, componentDims.size.y);
+    }
+
+    // coding parameters from the main header COD/COC segments
     kdu_core::siz_params *siz = codestream.access_siz();
     kdu_core::kdu_params *cod = siz->access_cluster(COD_params);
-    cod->get(Clevels, 0, 0, (int &)numDecompositions_);
-    cod->get(Corder, 0, 0, (int &)progressionOrder_);
+    int value = 0;
+    cod->get(Clevels, 0, 0, value);
+    numDecompositions_ = value;
+    cod->get(Corder, 0, 0, value);
+    progressionOrder_ = value;
+    cod->get(Clayers, 0, 0, value);
+    numLayers_ = value;
     cod->get(Creversible, 0, 0, isReversible_);
-    cod->get(Cblk, 0, 0, (int &)blockDimensions_.height);
-    cod->get(Cblk, 0, 1, (int &)blockDimensions_.width);
-
+    cod->get(Cycc, 0, 0, isUsingColorTransform_);
+    cod->get(Cblk, 0, 0, value);
+    blockDimensions_.height = value;
+    cod->get(Cblk, 0, 1, value);
+    blockDimensions_.width = value;
     isHTEnabled_ = codestream.get_ht_usage();
-    size_t bytesPerPixel = (frameInfo_.bitsPerSample + 1) / 8;
-    // Now decompress the image in one hit, using `kdu_stripe_decompressor'
-    size_t num_samples = kdu_core::kdu_memsafe_mul(frameInfo_.componentCount,
-                                                   kdu_core::kdu_memsafe_mul(frameInfo_.width,
-                                                                             frameInfo_.height));
-    pDecoded_->resize(num_samples * bytesPerPixel);
-    kdu_core::kdu_byte *buffer = pDecoded_->data();
+
+    // precinct sizes are recorded from the highest resolution down with the
+    // last record repeated for the lower resolutions.  Without precincts each
+    // resolution is a single precinct of the maximum size (2^15)
+    precinctSizes_.assign(numDecompositions_ + 1, Size(1 << 15, 1 << 15));
+    for (size_t level = 0; level <= numDecompositions_; level++)
+    {
+      int height, width;
+      if (cod->get(Cprecincts, (int)level, 0, height) && cod->get(Cprecincts, (int)level, 1, width))
+      {
+        precinctSizes_[level] = Size(width, height);
+      }
+    }
+
+    // tiling
+    kdu_core::kdu_dims tiles;
+    codestream.get_valid_tiles(tiles);
+    numTiles_ = Size(tiles.size.x, tiles.size.y);
+    int tileHeight, tileWidth;
+    if (siz->get(Stiles, 0, 0, tileHeight) && siz->get(Stiles, 0, 1, tileWidth))
+    {
+      tileSize_ = Size(tileWidth, tileHeight);
+    }
+    else
+    {
+      tileSize_ = fullResolution_;
+    }
+
+    scanPointerMarkers_();
+  }
+
+  void decode_(size_t decompositionLevel, kdu_core::kdu_dims *region, size_t stripeHeight = 0, StripeCallback *pCallback = NULL, const VOI *pVOI = NULL)
+  {
+    // reuse the codestream parsed by readHeader() if there is one.  It is
+    // consumed by the decode so the next call parses the header again, unless
+    // it belongs to an incremental decode session
+    stats_.begin("decode");
+    openCodestream_();
+    kdu_core::kdu_codestream &codestream = codestream_;
+    stats_.lap(stats_.stats().headerMs, "header");
+    if (stats_.isEnabled())
+    {
+      codestream.collect_timing_stats(1);
+    }
+
+    // discard the resolution levels that are not needed so their code-blocks
+    // are never decoded and the synthesis stops at the requested resolution.
+    // The region (if any) limits decoding to the precincts and code-blocks
+    // that contribute to it and the layer limit skips the passes of the
+    // discarded quality layers
+    if (decompositionLevel > (size_t)codestream.get_min_dwt_levels())
+    {
+      closeCodestream_();
+      throw "decompositionLevel exceeds the number of wavelet decompositions";
+    }
+    codestream.apply_input_restrictions(0, frameInfo_.componentCount, (int)decompositionLevel, (int)maxQualityLayers_, region);
+    kdu_core::kdu_dims dims;
+    codestream.get_dims(0, dims);
+    frameInfo_.width = dims.size.x;
+    frameInfo_.height = dims.size.y;
+    const bool rgba = outputFormat_ == OUTPUT_RGBA;
+    if (pVOI)
+    {
+      if (frameInfo_.componentCount != 1)
+      {
+        closeCodestream_();
+        throw "VOI decoding requires a single component image";
+      }
+      updateVOILut_(*pVOI);
+    }
+    if (rgba && frameInfo_.componentCount != 1 && frameInfo_.componentCount != 3)
+    {
+      closeCodestream_();
+      throw "RGBA output requires a single or three component image";
+    }
+
+    // the size of each component at the decoded resolution / region, which
+    // differ for subsampled components
+    componentSizes_.resize(frameInfo_.componentCount);
+    size_t numSamples = 0;
+    bool isSameSize = true;
+    for (size_t c = 0; c < frameInfo_.componentCount; c++)
+    {
+      kdu_core::kdu_dims componentDims;
+      codestream.get_dims((int)c, componentDims);
+      componentSizes_[c] = Size(componentDims.size.x, componentDims.size.y);
+      numSamples += kdu_core::kdu_memsafe_mul((size_t)componentDims.size.x, (size_t)componentDims.size.y);
+      isSameSize = isSameSize && componentDims.size == dims.size;
+    }
+    const bool planar = outputLayout_ == LAYOUT_PLANAR && !pVOI && !rgba;
+    if (planar && pCallback)
+    {
+      closeCodestream_();
+      throw "planar output is not supported by decodeStripes()";
+    }
+    if (!planar && !isSameSize)
+    {
+      closeCodestream_();
+      throw "interleaved output requires components of the same size, see setOutputLayout()";
+    }
+
+    // grayscale samples are mapped to the output by a table (VOI and/or
+    // palette) so they are pulled into the samples buffer first.  RGBA output
+    // without a VOI only needs the 8 most significant bits of each sample
+    const bool mapped = pVOI || (rgba && frameInfo_.componentCount == 1);
+    const size_t bytesPerSample = (rgba && !pVOI) ? 1 : (frameInfo_.bitsPerSample + 8 - 1) / 8;
+    const int precision = (rgba && !pVOI) ? std::min((int)frameInfo_.bitsPerSample, 8) : frameInfo_.bitsPerSample;
+    const size_t rowSize = kdu_core::kdu_memsafe_mul(rgba ? 4 : (pVOI ? 1 : frameInfo_.componentCount * bytesPerSample),
+                                                     (size_t)frameInfo_.width);
+
+    // without a callback or mapping the image is decompressed in one hit
+    // directly into the decoded buffer, otherwise one stripe at a time so each
+    // stripe is mapped while it is still in cache.  With a callback the output
+    // goes to the stripe buffer rather than the decoded buffer
+    const size_t mappedStripeHeight = 64;
+    size_t rowsPerStripe = frameInfo_.height;
+    if (pCallback)
+    {
+      rowsPerStripe = std::max(std::min(stripeHeight, (size_t)frameInfo_.height), (size_t)1);
+    }
+    else if (mapped)
+    {
+      rowsPerStripe = std::min(mappedStripeHeight, (size_t)frameInfo_.height);
+    }
+    kdu_core::kdu_byte *output = NULL;
+    if (pCallback)
+    {
+      output = resizeBuffer_(stripe_, kdu_core::kdu_memsafe_mul(rowsPerStripe, rowSize));
+    }
+    else if (planar)
+    {
+      output = allocateDecoded_(kdu_core::kdu_memsafe_mul(numSamples, bytesPerSample));
+    }
+    else
+    {
+      output = allocateDecoded_(kdu_core::kdu_memsafe_mul(frameInfo_.height, rowSize));
+    }
+    kdu_core::kdu_byte *samples = NULL;
+    if (mapped)
+    {
+      samples = resizeBuffer_(samples_, kdu_core::kdu_memsafe_mul(rowsPerStripe, kdu_core::kdu_memsafe_mul(frameInfo_.width, bytesPerSample)));
+    }
+
+    kdu_core::kdu_thread_env *env = threadEnv_.get();
     kdu_supp::kdu_stripe_decompressor decompressor;
-    decompressor.start(codestream);
-    int stripe_heights[3] = {frameInfo_.height, frameInfo_.height, frameInfo_.height};
+    try
+    {
+      decompressor.start(codestream, false, false, env);
+      stats_.lap(stats_.stats().startMs, "start");
+      for (size_t row = 0; row < frameInfo_.height; row += rowsPerStripe)
+      {
+        const size_t numRows = std::min(rowsPerStripe, frameInfo_.height - row);
+        const size_t numPixels = numRows * frameInfo_.width;
+        kdu_core::kdu_byte *stripe = pCallback ? output : output + row * rowSize;
+        if (mapped)
+        {
+          pullStripe_(decompressor, samples, numRows, bytesPerSample, precision);
+          stats_.lap(stats_.stats().processMs, "pull");
+          if (pVOI)
+          {
+            // in place when followed by the palette, each 8 bit result is
+            // written at or before the sample it was read from
+            applyVOILut_(samples, rgba ? samples : stripe, numPixels, bytesPerSample);
+          }
+          if (rgba)
+          {
+            applyPalette_(samples, stripe, numPixels);
+          }
+          stats_.lap(stats_.stats().outputMs, "map");
+        }
+        else if (rgba)
+        {
+          pullRGBAStripe_(decompressor, stripe, numRows, precision);
+          stats_.lap(stats_.stats().processMs, "pull");
+        }
+        else if (planar)
+        {
+          pullPlanar_(decompressor, stripe, bytesPerSample, precision);
+          stats_.lap(stats_.stats().processMs, "pull");
+        }
+        else
+        {
+          pullStripe_(decompressor, stripe, numRows, bytesPerSample, precision);
+          stats_.lap(stats_.stats().processMs, "pull");
+        }
+        if (pCallback)
+        {
+          emitStripe_(*pCallback, stripe, numRows * rowSize, row, numRows);
+          stats_.lap(stats_.stats().outputMs, "output");
+        }
+      }
+      decompressor.finish();
+    }
+    catch (...)
+    {
+      // let the thread environment recover before the codestream is destroyed
+      ThreadEnv::recover(env);
+      closeCodestream_();
+      throw;
+    }
+    ThreadEnv::terminate(env, codestream);
+    stats_.lap(stats_.stats().finishMs, "finish");
+    if (stats_.isEnabled())
+    {
+      stats_.codestream(codestream);
+      stats_.stats().bytes = (size_t)codestream.get_total_bytes();
+    }
+    if (!pIncrementalSource_)
+    {
+      closeCodestream_();
+    }
+    if (pVOI || rgba)
+    {
+      frameInfo_.bitsPerSample = 8;
+      frameInfo_.isSigned = false;
+    }
+    if (rgba)
+    {
+      frameInfo_.componentCount = 4;
+    }
+    stats_.end();
+  }
+
+  // builds the table mapping every stored sample value to 8 bits for voi.  The
+  // table is kept for the next call with the same voi and sample format
+  void updateVOILut_(const VOI &voi)
+  {
+    if (lutBitsPerSample_ == frameInfo_.bitsPerSample && lutIsSigned_ == frameInfo_.isSigned &&
+        lutVOI_.windowCenter == voi.windowCenter && lutVOI_.windowWidth == voi.windowWidth &&
+        lutVOI_.rescaleSlope == voi.rescaleSlope && lutVOI_.rescaleIntercept == voi.rescaleIntercept &&
+        lutVOI_.voiFunction == voi.voiFunction)
+    {
+      return;
+    }
+    if (voi.voiFunction == VOI_LINEAR ? !(voi.windowWidth >= 1.0) : !(voi.windowWidth > 0.0))
+    {
+      throw "windowWidth is out of range for the VOI function";
+    }
+
+    // the table is indexed by the stored value minus the smallest stored value
+    const size_t size = (size_t)1 << frameInfo_.bitsPerSample;
+    const double minValue = frameInfo_.isSigned ? -(double)(size / 2) : 0.0;
+    const double c = voi.windowCenter;
+    const double w = voi.windowWidth;
+    voiLut_.resize(size);
+    for (size_t i = 0; i < size; i++)
+    {
+      const double x = (minValue + i) * voi.rescaleSlope + voi.rescaleIntercept;
+      double y;
+      if (voi.voiFunction == VOI_SIGMOID)
+      {
+        y = 255.0 / (1.0 + std::exp(-4.0 * (x - c) / w));
+      }
+      else if (voi.voiFunction == VOI_LINEAR_EXACT)
+      {
+        y = ((x - c) / w + 0.5) * 255.0;
+      }
+      else
+      {
+        y = w > 1.0 ? ((x - (c - 0.5)) / (w - 1.0) + 0.5) * 255.0 : (x > c - 0.5 ? 255.0 : 0.0);
+      }
+      voiLut_[i] = (uint8_t)std::min(std::max(y + 0.5, 0.0), 255.0);
+    }
+    lutVOI_ = voi;
+    lutBitsPerSample_ = frameInfo_.bitsPerSample;
+    lutIsSigned_ = frameInfo_.isSigned;
+  }
 
-    bool is_signed[3] = {frameInfo_.isSigned, frameInfo_.isSigned, frameInfo_.isSigned};
-    if (bytesPerPixel == 1)
+  // maps numSamples samples from the stripe to 8 bits with the VOI table
+  void applyVOILut_(const kdu_core::kdu_byte *stripe, uint8_t *output, size_t numSamples, size_t bytesPerSample) const
+  {
+    const uint8_t *lut = voiLut_.data();
+    const uint32_t mask = (uint32_t)voiLut_.size() - 1;
+    if (bytesPerSample == 1)
     {
-      decompressor.pull_stripe((kdu_core::kdu_byte *)buffer, stripe_heights);
+      // byte stripes are always unsigned, signed samples are level shifted so
+      // the smallest value is already 0
+      for (size_t i = 0; i < numSamples; i++)
+      {
+        output[i] = lut[stripe[i] & mask];
+      }
+    }
+    else
+    {
+      // signed samples are sign extended so adding the offset maps the
+      // smallest value to 0, unsigned samples are zero extended
+      const uint16_t *samples = (const uint16_t *)stripe;
+      if (frameInfo_.isSigned)
+      {
+        const uint32_t offset = (uint32_t)voiLut_.size() / 2;
+        for (size_t i = 0; i < numSamples; i++)
+        {
+          output[i] = lut[((uint32_t)(int32_t)(int16_t)samples[i] + offset) & mask];
+        }
+      }
+      else
+      {
+        for (size_t i = 0; i < numSamples; i++)
+        {
+          output[i] = lut[samples[i] & mask];
+        }
+      }
+    }
+  }
+
+  // pulls numRows rows of every component interleaved into buffer
+  void pullStripe_(kdu_supp::kdu_stripe_decompressor &decompressor, kdu_core::kdu_byte *buffer, size_t numRows, size_t bytesPerSample, int precision)
+  {
+    int stripe_heights[maxComponents_];
+    int precisions[maxComponents_];
+    bool is_signed[maxComponents_];
+    for (size_t c = 0; c < frameInfo_.componentCount; c++)
+    {
+      stripe_heights[c] = (int)numRows;
+      precisions[c] = precision;
+      is_signed[c] = frameInfo_.isSigned;
+    }
+    if (bytesPerSample == 1)
+    {
+      decompressor.pull_stripe(buffer, stripe_heights, NULL, NULL, NULL, precisions);
     }
     else
     {
       decompressor.pull_stripe(
           (kdu_core::kdu_int16 *)buffer,
           stripe_heights,
-          NULL,      // sample_offsets
-          NULL,      // sample_gaps
-          NULL,      // row_gaps
-          NULL,      // precisions
-          is_signed, // is_signed
-          NULL,      // pad_flags
-          0          // vectorized_store_prefs
+          NULL,       // sample_offsets
+          NULL,       // sample_gaps
+          NULL,       // row_gaps
+          precisions, // precisions
+          is_signed,  // is_signed
+          NULL,       // pad_flags
+          0           // vectorized_store_prefs
       );
     }
-    decompressor.finish();
+  }
+
+  // pulls every component in one hit into consecutive planes of buffer, the
+  // row gaps default to the width of each component
+  void pullPlanar_(kdu_supp::kdu_stripe_decompressor &decompressor, kdu_core::kdu_byte *buffer, size_t bytesPerSample, int precision)
+  {
+    kdu_core::kdu_byte *planes[maxComponents_];
+    int stripe_heights[maxComponents_];
+    int precisions[maxComponents_];
+    bool is_signed[maxComponents_];
+    size_t offset = 0;
+    for (size_t c = 0; c < frameInfo_.componentCount; c++)
+    {
+      planes[c] = buffer + offset;
+      offset += (size_t)componentSizes_[c].width * componentSizes_[c].height * bytesPerSample;
+      stripe_heights[c] = (int)componentSizes_[c].height;
+      precisions[c] = precision;
+      is_signed[c] = frameInfo_.isSigned;
+    }
+    if (bytesPerSample == 1)
+    {
+      decompressor.pull_stripe(planes, stripe_heights, NULL, NULL, precisions);
+    }
+    else
+    {
+      decompressor.pull_stripe((kdu_core::kdu_int16 **)planes, stripe_heights, NULL, NULL, precisions, is_signed);
+    }
+  }
+
+  // pulls the three components interleaved into the red, green and blue bytes
+  // of each RGBA pixel and sets alpha to opaque
+  void pullRGBAStripe_(kdu_supp::kdu_stripe_decompressor &decompressor, kdu_core::kdu_byte *buffer, size_t numRows, int precision)
+  {
+    int stripe_heights[3] = {(int)numRows, (int)numRows, (int)numRows};
+    int sample_offsets[3] = {0, 1, 2};
+    int sample_gaps[3] = {4, 4, 4};
+    int precisions[3] = {precision, precision, precision};
+    decompressor.pull_stripe(buffer, stripe_heights, sample_offsets, sample_gaps, NULL, precisions);
+    const size_t numPixels = numRows * frameInfo_.width;
+    for (size_t i = 0; i < numPixels; i++)
+    {
+      buffer[i * 4 + 3] = 255;
+    }
+  }
+
+  // expands numPixels 8 bit grayscale values to RGBA with the palette
+  void applyPalette_(const uint8_t *gray, uint8_t *rgba, size_t numPixels) const
+  {
+    const uint8_t *palette = palette_.data();
+    for (size_t i = 0; i < numPixels; i++)
+    {
+      memcpy(rgba + i * 4, palette + gray[i] * 4, 4);
+    }
+  }
+
+  // resizes an internal buffer recording the allocation
+  kdu_core::kdu_byte *resizeBuffer_(std::vector<uint8_t> &buffer, size_t size)
+  {
+    const size_t capacity = buffer.capacity();
+    buffer.resize(size);
+    stats_.buffer(capacity, buffer.capacity(), buffer.size());
+    return buffer.data();
+  }
+
+  void emitStripe_(StripeCallback &callback, const kdu_core::kdu_byte *stripe, size_t stripeSize, size_t firstRow, size_t numRows)
+  {
+#ifdef __EMSCRIPTEN__
+    callback(emscripten::val(emscripten::typed_memory_view(stripeSize, stripe)), firstRow, numRows);
+#else
+    callback(stripe, stripeSize, firstRow, numRows);
+#endif
+  }
+
+  // returns the canvas region of a tile in raster order
+  kdu_core::kdu_dims getTileRegion_(kdu_core::kdu_codestream &codestream, size_t tileIndex) const
+  {
+    kdu_core::kdu_dims tiles;
+    codestream.get_valid_tiles(tiles);
+    kdu_core::kdu_coords index = tiles.pos + kdu_core::kdu_coords((int)(tileIndex % tiles.size.x), (int)(tileIndex / tiles.size.x));
+    kdu_core::kdu_dims region;
+    codestream.get_tile_dims(index, -1, region);
+    return region;
+  }
+
+  // decodes tiles claimed from nextTile into their region of output until all
+  // tiles are done.  Each worker has its own persistent codestream so the main
+  // header is parsed once per worker and tiles are located via TLM if present
+  void decodeTilesWorker_(size_t decompositionLevel, kdu_core::kdu_dims image, uint8_t *output, size_t rowSize,
+                          std::atomic<size_t> &nextTile, std::exception_ptr *pError)
+  {
+    const size_t offset = findCodestream_();
+    kdu_core::kdu_compressed_source_buffered source((kdu_core::kdu_byte *)getEncodedData_() + offset, getEncodedSize_() - offset);
+    kdu_core::kdu_codestream codestream;
+    try
+    {
+      codestream.create(&source);
+      codestream.set_persistent();
+      const size_t numTiles = (size_t)numTiles_.width * numTiles_.height;
+      const size_t bytesPerSample = (frameInfo_.bitsPerSample + 8 - 1) / 8;
+      const int rowGap = (int)(frameInfo_.componentCount * frameInfo_.width);
+      int stripe_heights[maxComponents_];
+      int row_gaps[maxComponents_];
+      int precisions[maxComponents_];
+      bool is_signed[maxComponents_];
+      for (size_t tileIndex = nextTile++; tileIndex < numTiles; tileIndex = nextTile++)
+      {
+        kdu_core::kdu_dims region = getTileRegion_(codestream, tileIndex);
+        codestream.apply_input_restrictions(0, frameInfo_.componentCount, (int)decompositionLevel, (int)maxQualityLayers_, &region);
+        kdu_core::kdu_dims dims;
+        codestream.get_dims(0, dims);
+        if (dims.is_empty())
+        {
+          continue; // the tile vanishes at this resolution
+        }
+        for (size_t c = 0; c < frameInfo_.componentCount; c++)
+        {
+          stripe_heights[c] = dims.size.y;
+          row_gaps[c] = rowGap;
+          precisions[c] = frameInfo_.bitsPerSample;
+          is_signed[c] = frameInfo_.isSigned;
+        }
+        uint8_t *tile = output + (size_t)(dims.pos.y - image.pos.y) * rowSize +
+                        (size_t)(dims.pos.x - image.pos.x) * frameInfo_.componentCount * bytesPerSample;
+        kdu_supp::kdu_stripe_decompressor decompressor;
+        decompressor.start(codestream);
+        if (bytesPerSample == 1)
+        {
+          decompressor.pull_stripe(tile, stripe_heights, NULL, NULL, row_gaps, precisions);
+        }
+        else
+        {
+          decompressor.pull_stripe((kdu_core::kdu_int16 *)tile, stripe_heights, NULL, NULL, row_gaps, precisions, is_signed);
+        }
+        decompressor.finish();
+      }
+    }
+    catch (...)
+    {
+      *pError = std::current_exception();
+      nextTile = (size_t)numTiles_.width * numTiles_.height; // stop the other workers
+    }
+    if (codestream.exists())
+    {
+      codestream.destroy();
+    }
+    source.close();
   }
 
   std::vector<uint8_t> *pEncoded_;
   std::vector<uint8_t> *pDecoded_;
+  const uint8_t *pExternal_;
+  size_t externalSize_;
+#ifndef __EMSCRIPTEN__
+  MappedFile mappedFile_;
+#endif
+  std::unique_ptr<kdu_core::kdu_compressed_source_buffered> pSource_;
+  std::unique_ptr<kdu_growing_source> pIncrementalSource_;
+  kdu_core::kdu_codestream codestream_;
   std::vector<uint8_t> encodedInternal_;
   std::vector<uint8_t> decodedInternal_;
+  std::vector<uint8_t> stripe_;
+  std::vector<uint8_t> samples_;
+  std::vector<uint8_t> palette_;
+  OutputFormat outputFormat_;
+  OutputLayout outputLayout_;
+  std::vector<Slot> slots_;
+  Slot *pSlot_;
+  std::vector<ByteRange> sparseFilled_;
+  bool isSparse_;
+  size_t incrementalDecodedSize_;
+  size_t maxQualityLayers_;
 
   // std::vector<uint8_t> encoded_;
   // std::vector<uint8_t> decoded_;
   FrameInfo frameInfo_;
+  Size fullResolution_;
   std::vector<Point> downSamples_;
+  std::vector<Size> componentSizes_;
   size_t numDecompositions_;
   bool isReversible_;
   size_t progressionOrder_;
   Size blockDimensions_;
   bool isUsingColorTransform_;
   bool isHTEnabled_;
+  size_t numLayers_;
+  Size tileSize_;
+  Size numTiles_;
+  std::vector<Size> precinctSizes_;
+  StatsRecorder stats_;
+  bool hasPLT_;
+  bool hasTLM_;
+  std::vector<uint8_t> voiLut_;
+  VOI lutVOI_;
+  uint8_t lutBitsPerSample_;
+  bool lutIsSigned_;
+  ThreadEnv threadEnv_;
 };
@@ -15,31 +15,118 @@
 // Application level includes
 #include "kdu_stripe_compressor.h"
 
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <memory>
+#include <string>
+#include <vector>
+
+#ifndef KDU_NO_THREADS
+#include <thread>
+#endif
+
 #ifdef __EMSCRIPTEN__
 #include <emscripten/val.h>
 #endif
 
 #include "FrameInfo.hpp"
+#include "Stats.hpp"
+#include "ThreadEnv.hpp"
 
+/// <summary>
+/// Kakadu compressed target that writes to memory, either a std::vector that
+/// is appended to (its capacity from the previous encode is kept so repeated
+/// encodes do not reallocate, and the bytes are never zero filled first) or a
+/// fixed size caller owned buffer which is never reallocated.  Supports
+/// rewriting so Kakadu can fill in TLM markers
+/// </summary>
 class kdu_buffer_target : public kdu_core::kdu_compressed_target
 {
 public: // Member functions
-  kdu_buffer_target(std::vector<uint8_t> &encoded) : encoded_(encoded)
+  kdu_buffer_target(std::vector<uint8_t> &encoded) : pEncoded_(&encoded),
+                                                     data_(NULL),
+                                                     capacity_(0),
+                                                     size_(0),
+                                                     rewriteOffset_(-1)
+  {
+    // clear() keeps the capacity for this encode
+    pEncoded_->clear();
+  }
+  kdu_buffer_target(uint8_t *pBuffer, size_t capacity) : pEncoded_(NULL),
+                                                         data_(pBuffer),
+                                                         capacity_(capacity),
+                                                         size_(0),
+                                                         rewriteOffset_(-1)
   {
-    encoded_.resize(0);
   }
   ~kdu_buffer_target() { return; } // Destructor must be virtual
   int get_capabilities() { return KDU_TARGET_CAP_CACHED; }
   bool write(const kdu_core::kdu_byte *buf, int num_bytes)
   {
-    const size_t size = encoded_.size();
-    encoded_.resize(size + num_bytes);
-    memcpy(encoded_.data() + size, buf, num_bytes);
+    if (rewriteOffset_ >= 0)
+    {
+      // rewrites only overwrite bytes already written
+      if ((size_t)rewriteOffset_ + num_bytes > size_)
+      {
+        return false;
+      }
+      memcpy((pEncoded_ ? pEncoded_->data() : data_) + rewriteOffset_, buf, num_bytes);
+      rewriteOffset_ += num_bytes;
+      return true;
+    }
+    if (pEncoded_)
+    {
+      pEncoded_->insert(pEncoded_->end(), buf, buf + num_bytes);
+    }
+    else
+    {
+      if (size_ + num_bytes > capacity_)
+      {
+        return false; // caller owned buffer is full
+      }
+      memcpy(data_ + size_, buf, num_bytes);
+    }
+    size_ += num_bytes;
+    return true;
+  }
+  bool start_rewrite(kdu_core::kdu_long backtrack)
+  {
+    if (rewriteOffset_ >= 0 || backtrack < 0 || (size_t)backtrack > size_)
+    {
+      return false;
+    }
+    rewriteOffset_ = size_ - (size_t)backtrack;
     return true;
   }
+  bool end_rewrite()
+  {
+    if (rewriteOffset_ < 0)
+    {
+      return false;
+    }
+    rewriteOffset_ = -1;
+    return true;
+  }
+  bool close()
+  {
+    return true;
+  }
+
+  /// <summary>
+  /// returns the number of bytes written
+  /// </summary>
+  size_t size() const
+  {
+    return size_;
+  }
 
 private: // Data
-  std::vector<uint8_t> &encoded_;
+  std::vector<uint8_t> *pEncoded_;
+  uint8_t *data_;
+  size_t capacity_;
+  size_t size_;
+  kdu_core::kdu_long rewriteOffset_;
 };
 
 /// <summary>
@@ -56,10 +143,25 @@ public:
                    quantizationStep_(-1.0),
                    progressionOrder_(2), // RPCL
                    blockDimensions_(64, 64),
-                   htEnabled_(true)
+                   htEnabled_(true),
+                   pltEnabled_(false),
+                   tlmEnabled_(false),
+                   numLayers_(1),
+                   targetSize_(0),
+                   targetBitsPerPixel_(0.0f),
+                   jp2Enabled_(true),
+                   pEncodedBuffer_(NULL),
+                   encodedBufferCapacity_(0),
+                   encodedSize_(0),
+                   statsCapacity_(0)
   {
   }
 
+  ~HTJ2KEncoder()
+  {
+    abort_(session_, false);
+  }
+
 #ifdef __EMSCRIPTEN__
   /// <summary>
   /// Resizes the decoded buffer to accomodate the specified frameInfo.
@@ -95,6 +197,22 @@ public:
   {
     return emscripten::val(emscripten::typed_memory_view(encoded_.size(), encoded_.data()));
   }
+
+  /// <summary>
+  /// Sets a buffer of capacity bytes at byteOffset in WASM memory, e.g. from
+  /// Module._malloc(), to encode into instead of the internal encoded buffer.
+  /// This lets an application encode straight into memory it manages itself
+  /// (a pool shared by several encoders or a frame of a larger output) and
+  /// read the result with Module.HEAPU8.subarray(byteOffset, byteOffset +
+  /// getEncodedSize()).  The buffer is never reallocated, encode() throws if
+  /// the bitstream does not fit.  getEncodedBuffer() is empty while it is set.
+  /// Set byteOffset to 0 to reset to the internal buffer
+  /// </summary>
+  void setEncodedBuffer(size_t byteOffset, size_t capacity)
+  {
+    pEncodedBuffer_ = (uint8_t *)byteOffset;
+    encodedBufferCapacity_ = pEncodedBuffer_ ? capacity : 0;
+  }
 #else
   /// <summary>
   /// Returns the buffer to store the decoded bytes.  This method is not
@@ -114,8 +232,74 @@ public:
   {
     return encoded_;
   }
+
+  /// <summary>
+  /// Sets a caller owned buffer of capacity bytes to encode into instead of
+  /// the internal encoded buffer.  The buffer is never reallocated, encode()
+  /// throws if the bitstream does not fit.  Use getEncodedSize() to get the
+  /// number of bytes written, getEncodedBytes() is empty while it is set.  Set
+  /// to 0 to reset to the internal buffer.  JavaScript passes an offset into
+  /// WASM memory instead of a pointer
+  /// </summary>
+  void setEncodedBuffer(uint8_t *pBuffer, size_t capacity)
+  {
+    pEncodedBuffer_ = pBuffer;
+    encodedBufferCapacity_ = pBuffer ? capacity : 0;
+  }
 #endif
 
+  /// <summary>
+  /// returns the number of bytes written by the last encode
+  /// </summary>
+  size_t getEncodedSize() const
+  {
+    return encodedSize_;
+  }
+
+  /// <summary>
+  /// Enables recording statistics for each encode, see getStats().  Disabled
+  /// by default, the overhead when disabled is a branch per encode phase.
+  /// Batch encodes are not recorded
+  /// </summary>
+  void setStatsEnabled(bool enabled)
+  {
+    stats_.setEnabled(enabled);
+  }
+
+  /// <summary>
+  /// Enables collecting Chrome trace events for every encode while statistics
+  /// are enabled, see getTraceJson()
+  /// </summary>
+  void setTraceEnabled(bool enabled)
+  {
+    stats_.setTraceEnabled(enabled);
+  }
+
+  /// <summary>
+  /// returns the statistics of the last encode, see setStatsEnabled()
+  /// </summary>
+  Stats getStats() const
+  {
+    return stats_.getStats();
+  }
+
+  /// <summary>
+  /// returns the trace events collected since the last clearTrace() as Chrome
+  /// trace event JSON (load it in chrome://tracing or Perfetto)
+  /// </summary>
+  std::string getTraceJson() const
+  {
+    return stats_.getTraceJson();
+  }
+
+  /// <summary>
+  /// discards the collected trace events
+  /// </summary>
+  void clearTrace()
+  {
+    stats_.clearTrace();
+  }
+
   /// <summary>
   /// Sets the number of wavelet decompositions and clears any precincts
   /// </summary>
@@ -164,121 +348,750 @@ public:
     htEnabled_ = htEnabled;
   }
 
+  /// <summary>
+  /// Sets the tile size.  A size of 0,0 (the default) encodes the image as a
+  /// single tile.  Tiles are coded independently so a decoder can skip the
+  /// tiles outside a region of interest entirely.
+  /// </summary>
+  void setTileSize(Size tileSize)
+  {
+    tileSize_ = tileSize;
+  }
+
+  /// <summary>
+  /// Sets the precinct size used for every resolution (powers of 2).  A size
+  /// of 0,0 (the default) uses one precinct per resolution.  Smaller precincts
+  /// split each resolution into spatially local packets so a decoder can read
+  /// just the packets covering a region of interest.
+  /// </summary>
+  void setPrecinctSize(Size precinctSize)
+  {
+    precinctSize_ = precinctSize;
+  }
+
+  /// <summary>
+  /// Sets whether PLT (packet length) marker segments are written to the tile
+  /// part headers (default false).  They let a decoder seek directly to the
+  /// packets of a resolution or precinct without parsing the packet headers
+  /// in between.
+  /// </summary>
+  void setPLTEnabled(bool pltEnabled)
+  {
+    pltEnabled_ = pltEnabled;
+  }
+
+  /// <summary>
+  /// Sets whether a TLM (tile part length) marker segment is written to the
+  /// main header (default false).  It lets a decoder seek directly to any tile
+  /// without walking the tile parts before it.
+  /// </summary>
+  void setTLMEnabled(bool tlmEnabled)
+  {
+    tlmEnabled_ = tlmEnabled;
+  }
+
+  /// <summary>
+  /// Sets the number of quality layers (default 1).  Without layer rates the
+  /// rate of the final layer is set by setTargetSize() / setTargetBitsPerPixel()
+  /// (or includes everything if neither is set) and the lower layers are
+  /// spaced automatically by Kakadu.
+  /// </summary>
+  void setQualityLayers(size_t numLayers)
+  {
+    numLayers_ = numLayers;
+  }
+
+  /// <summary>
+  /// Sets the maximum size in bytes of the encoded bitstream.  Rate control
+  /// truncates the code-block passes to fit.  0 disables (the default).
+  /// Takes precedence over setTargetBitsPerPixel()
+  /// </summary>
+  void setTargetSize(size_t targetSize)
+  {
+    targetSize_ = targetSize;
+  }
+
+  /// <summary>
+  /// Sets the maximum bit rate of the encoded bitstream in bits per pixel,
+  /// (i.e. the target size is width * height * bitsPerPixel / 8 bytes).  0
+  /// disables (the default).
+  /// </summary>
+  void setTargetBitsPerPixel(float bitsPerPixel)
+  {
+    targetBitsPerPixel_ = bitsPerPixel;
+  }
+
+  /// <summary>
+  /// Sets the cumulative bit rate in bits per pixel of each quality layer,
+  /// lowest layer first.  Overrides setQualityLayers() and the target size
+  /// with one layer per rate.  0 for a layer lets Kakadu pick its rate (use 0
+  /// for the last layer to include everything).  Pass an empty list to clear.
+  /// </summary>
+  void setLayerBitsPerPixel(const std::vector<float> &layerBitsPerPixel)
+  {
+    layerBitsPerPixel_ = layerBitsPerPixel;
+  }
+
+  /// <summary>
+  /// Sets whether the codestream is wrapped in the JP2 file format (the
+  /// default).  Disable to produce a bare J2C codestream as used by DICOM
+  /// without the cost of writing the JP2 boxes.
+  /// </summary>
+  void setJP2Enabled(bool jp2Enabled)
+  {
+    jp2Enabled_ = jp2Enabled;
+  }
+
+  /// <summary>
+  /// Sets the number of threads used to encode a single frame.  0 or 1 encodes
+  /// on the calling thread only (the default).  Values greater than 1 create
+  /// a Kakadu thread environment with that many threads (including the calling
+  /// thread) which is kept alive and reused by subsequent encodes.  Lossless
+  /// single layer encodes (the default) produce the same bitstream regardless
+  /// of the number of threads, which the tests verify.  With rate control or
+  /// several quality layers that is not guaranteed.  For encodeBatch() it is
+  /// the number of frames encoded in parallel instead. Has no effect if Kakadu
+  /// was built without threading (KDU_NO_THREADS).
+  /// </summary>
+  void setNumThreads(size_t numThreads)
+  {
+    threadEnv_.setNumThreads(numThreads);
+  }
+
+  /// <summary>
+  /// returns the number of threads requested via setNumThreads()
+  /// </summary>
+  size_t getNumThreads() const
+  {
+    return threadEnv_.getNumThreads();
+  }
+
+#if !defined(__EMSCRIPTEN__) && !defined(KDU_NO_THREADS)
+  /// <summary>
+  /// Sets a caller owned Kakadu thread environment to encode with.  This allows
+  /// a single thread pool to be shared with other encoders and decoders as long
+  /// as they are all called from the thread that created the environment.  The
+  /// environment takes precedence over setNumThreads().  Set to 0 to stop using
+  /// it.  This method is not exported to JavaScript, it is intended to be called
+  /// by C++ code
+  /// </summary>
+  void setThreadEnv(kdu_core::kdu_thread_env *pThreadEnv)
+  {
+    threadEnv_.setExternal(pThreadEnv);
+  }
+#endif
+
   /// <summary>
   /// Executes an HTJ2K encode using the data in the source buffer.  The
   /// JavaScript code must copy the source image frame into the source
   /// buffer before calling this method.  See documentation on getSourceBytes()
-  /// above
+  /// above.  Any streaming encode that was not finished is abandoned.
   /// </summary>
   void encode()
   {
-    // resize the encoded buffer so we don't have to keep resizing it
-    const size_t bytesPerPixel = (frameInfo_.bitsPerSample + 8 - 1) / 8;
-    encoded_.reserve(frameInfo_.width * frameInfo_.height * frameInfo_.componentCount * bytesPerPixel);
+    abort_(session_, false);
+    statsBegin_();
+    Config config;
+    prepare_(frameInfo_, config);
+    begin_(session_, frameInfo_, config, createTarget_(), threadEnv_.get());
+    stats_.lap(stats_.stats().startMs, "start");
+    push_(session_, frameInfo_, decoded_.data(), frameInfo_.height);
+    stats_.lap(stats_.stats().processMs, "push");
+    encodedSize_ = finish_(session_, frameInfo_);
+    statsEnd_();
+  }
 
-    //  Construct code-stream object
-    kdu_core::siz_params siz;
-    siz.set(Scomponents, 0, 0, frameInfo_.componentCount);
-    siz.set(Sdims, 0, 0, frameInfo_.height);
-    siz.set(Sdims, 0, 1, frameInfo_.width);
-    siz.set(Sprecision, 0, 0, frameInfo_.bitsPerSample);
-    siz.set(Ssigned, 0, 0, frameInfo_.isSigned);
-    kdu_core::kdu_params *siz_ref = &siz;
-    siz_ref->finalize();
+  /// <summary>
+  /// Starts a streaming encode of an image described by frameInfo.  Rows of
+  /// pixel data are then pushed in order with encodeStripe() as they become
+  /// available (e.g. from an acquisition device or a decompressor) followed by
+  /// finishEncode().  Only the stripes are held in memory rather than the whole
+  /// frame and encoding overlaps with the production of the pixel data.  Any
+  /// streaming encode that was not finished is abandoned.
+  /// </summary>
+  void beginEncode(const FrameInfo &frameInfo)
+  {
+    abort_(session_, false);
+    frameInfo_ = frameInfo;
+    statsBegin_();
+    Config config;
+    prepare_(frameInfo_, config);
+    begin_(session_, frameInfo_, config, createTarget_(), threadEnv_.get());
+    stats_.lap(stats_.stats().startMs, "start");
+  }
+
+#ifdef __EMSCRIPTEN__
+  /// <summary>
+  /// Resizes the stripe buffer to hold numRows rows of pixel data and returns
+  /// a TypedArray of it.  JavaScript code needs to copy the next numRows rows
+  /// of pixel data into the returned TypedArray before calling
+  /// encodeStripe(numRows).
+  /// </summary>
+  emscripten::val getStripeBuffer(size_t numRows)
+  {
+    stripe_.resize(numRows * getRowSize_(frameInfo_));
+    return emscripten::val(emscripten::typed_memory_view(stripe_.size(), stripe_.data()));
+  }
+
+  /// <summary>
+  /// Encodes the next numRows rows of pixel data from the stripe buffer, see
+  /// getStripeBuffer() and beginEncode()
+  /// </summary>
+  void encodeStripe(size_t numRows)
+  {
+    stats_.resume();
+    push_(session_, frameInfo_, stripe_.data(), numRows);
+    stats_.lap(stats_.stats().processMs, "push");
+  }
+#else
+  /// <summary>
+  /// Encodes the next numRows rows of pixel data which are stored contiguously
+  /// at pRows in the same layout as the decoded buffer, see beginEncode().  This
+  /// method is not exported to JavaScript, it is intended to be called by C++ code
+  /// </summary>
+  void encodeStripe(const uint8_t *pRows, size_t numRows)
+  {
+    stats_.resume();
+    push_(session_, frameInfo_, pRows, numRows);
+    stats_.lap(stats_.stats().processMs, "push");
+  }
+#endif
 
-    kdu_buffer_target target(encoded_);
+  /// <summary>
+  /// Completes a streaming encode once all rows have been pushed, see
+  /// beginEncode().  The encoded bitstream is then available from the encoded
+  /// buffer as with encode()
+  /// </summary>
+  void finishEncode()
+  {
+    stats_.resume();
+    encodedSize_ = finish_(session_, frameInfo_);
+    statsEnd_();
+  }
+
+#ifdef __EMSCRIPTEN__
+  /// <summary>
+  /// Resizes the decoded buffer to hold numFrames frames described by frameInfo
+  /// stored one after the other and returns a TypedArray of it.  JavaScript
+  /// code needs to copy the pixel data of every frame into the returned
+  /// TypedArray before calling encodeBatch()
+  /// </summary>
+  emscripten::val getBatchDecodedBuffer(const FrameInfo &frameInfo, size_t numFrames)
+  {
+    frameInfo_ = frameInfo;
+    decoded_.resize(numFrames * getRowSize_(frameInfo_) * frameInfo_.height);
+    batchEncoded_.resize(numFrames);
+    return emscripten::val(emscripten::typed_memory_view(decoded_.size(), decoded_.data()));
+  }
+
+  /// <summary>
+  /// Returns a TypedArray of the encoded bitstream of a frame of the last
+  /// encodeBatch()
+  /// </summary>
+  emscripten::val getBatchEncodedBuffer(size_t frame)
+  {
+    std::vector<uint8_t> &encoded = batchEncoded_.at(frame);
+    return emscripten::val(emscripten::typed_memory_view(encoded.size(), encoded.data()));
+  }
+#else
+  /// <summary>
+  /// Resizes the decoded buffer to hold numFrames frames described by frameInfo
+  /// stored one after the other and returns it.  The pixel data of every frame
+  /// needs to be copied into it before calling encodeBatch().  This method is
+  /// not exported to JavaScript, it is intended to be called by C++ code
+  /// </summary>
+  std::vector<uint8_t> &getBatchDecodedBytes(const FrameInfo &frameInfo, size_t numFrames)
+  {
+    frameInfo_ = frameInfo;
+    decoded_.resize(numFrames * getRowSize_(frameInfo_) * frameInfo_.height);
+    batchEncoded_.resize(numFrames);
+    return decoded_;
+  }
+
+  /// <summary>
+  /// Returns the encoded bitstream of a frame of the last encodeBatch().  This
+  /// method is not exported to JavaScript, it is intended to be called by C++
+  /// code
+  /// </summary>
+  const std::vector<uint8_t> &getBatchEncodedBytes(size_t frame) const
+  {
+    return batchEncoded_.at(frame);
+  }
+#endif
+
+  /// <summary>
+  /// returns the number of frames in the batch, see getBatchDecodedBytes()
+  /// </summary>
+  size_t getBatchSize() const
+  {
+    return batchEncoded_.size();
+  }
+
+  /// <summary>
+  /// Encodes every frame of the batch, see getBatchDecodedBytes().  The frames
+  /// are encoded in parallel by setNumThreads() workers, each encoding whole
+  /// frames on its own thread (unless Kakadu was built without threading).
+  /// Each worker prepares the coding parameters once for all of its frames.
+  /// The encoded buffers are kept between batches so their memory is reused.
+  /// Each frame is identical to encoding it on its own with encode() on a
+  /// single thread.  getStats() reports the whole batch, without the block
+  /// coder timing and codestream memory of the individual frames.
+  /// </summary>
+  void encodeBatch()
+  {
+    const size_t numFrames = batchEncoded_.size();
+    if (decoded_.size() < numFrames * getRowSize_(frameInfo_) * frameInfo_.height)
+    {
+      throw "the decoded buffer is smaller than the batch";
+    }
+    stats_.begin("encodeBatch");
+    std::vector<size_t> capacities;
+    if (stats_.isEnabled())
+    {
+      for (size_t frame = 0; frame < numFrames; frame++)
+      {
+        capacities.push_back(batchEncoded_[frame].capacity());
+      }
+    }
+    std::atomic<size_t> nextFrame(0);
+    size_t numWorkers = 1;
+#ifndef KDU_NO_THREADS
+    numWorkers = std::max(std::min(threadEnv_.getNumThreads(), numFrames), (size_t)1);
+#endif
+    std::vector<std::exception_ptr> errors(numWorkers);
+#ifndef KDU_NO_THREADS
+    std::vector<std::thread> workers;
+    for (size_t worker = 1; worker < numWorkers; worker++)
+    {
+      workers.push_back(std::thread(&HTJ2KEncoder::encodeBatchFrames_, this, std::ref(nextFrame), &errors[worker]));
+    }
+#endif
+    encodeBatchFrames_(nextFrame, &errors[0]);
+#ifndef KDU_NO_THREADS
+    for (size_t worker = 0; worker < workers.size(); worker++)
+    {
+      workers[worker].join();
+    }
+#endif
+    for (size_t worker = 0; worker < numWorkers; worker++)
+    {
+      if (errors[worker])
+      {
+        std::rethrow_exception(errors[worker]);
+      }
+    }
+    stats_.lap(stats_.stats().processMs, "frames");
+    if (stats_.isEnabled())
+    {
+      for (size_t frame = 0; frame < numFrames; frame++)
+      {
+        stats_.stats().bytes += batchEncoded_[frame].size();
+        stats_.buffer(capacities[frame], batchEncoded_[frame].capacity(), batchEncoded_[frame].size());
+      }
+    }
+    stats_.end();
+  }
+
+private:
+  // the largest componentCount FrameInfo can describe
+  static const size_t maxComponents_ = 255;
+
+  // The state of an encode from begin_() to finish_()
+  struct Session
+  {
+    Session() : env(NULL), rowsPushed(0), pStats(NULL) {}
+
+    std::unique_ptr<kdu_buffer_target> pTarget;
     kdu_supp::jp2_family_tgt tgt;
-    tgt.open(&target);
     kdu_supp::jp2_target output;
-    output.open(&tgt);
-    kdu_supp::jp2_dimensions dims = output.access_dimensions();
-    dims.init(&siz);
-    kdu_supp::jp2_colour colr = output.access_colour();
-    colr.init((frameInfo_.componentCount == 3) ? kdu_supp::JP2_sRGB_SPACE : kdu_supp::JP2_sLUM_SPACE);
-    output.write_header();
-    output.open_codestream(true);
+    kdu_core::kdu_codestream codestream;
+    std::unique_ptr<kdu_supp::kdu_stripe_compressor> pCompressor;
+    kdu_core::kdu_thread_env *env;
+    size_t rowsPushed;
+    StatsRecorder *pStats; // NULL for the batch sessions
+  };
+
+  // The coding parameters shared by every frame of the same geometry.  They
+  // are parsed and finalized once in an interchange codestream (one without
+  // a target) which begin_() copies into the codestream of each frame
+  struct Config
+  {
+    Config() {}
+    ~Config()
+    {
+      if (codestream.exists())
+      {
+        codestream.destroy();
+      }
+    }
 
     kdu_core::kdu_codestream codestream;
-    codestream.create(&siz, &output);
+    std::vector<kdu_core::kdu_long> layerSizes;
+
+  private:
+    Config(const Config &);
+    Config &operator=(const Config &);
+  };
+
+  static size_t getRowSize_(const FrameInfo &frameInfo)
+  {
+    const size_t bytesPerSample = (frameInfo.bitsPerSample + 8 - 1) / 8;
+    return (size_t)frameInfo.width * frameInfo.componentCount * bytesPerSample;
+  }
+
+  // returns the cumulative size in bytes of each quality layer, 0 lets the
+  // rate allocation pick the size of that layer
+  std::vector<kdu_core::kdu_long> getLayerSizes_(const FrameInfo &frameInfo) const
+  {
+    const double pixels = (double)frameInfo.width * frameInfo.height;
+    std::vector<kdu_core::kdu_long> layerSizes;
+    if (!layerBitsPerPixel_.empty())
+    {
+      for (size_t layer = 0; layer < layerBitsPerPixel_.size(); layer++)
+      {
+        layerSizes.push_back((kdu_core::kdu_long)(layerBitsPerPixel_[layer] * pixels / 8.0));
+      }
+      return layerSizes;
+    }
+    layerSizes.assign(std::max(numLayers_, (size_t)1), 0);
+    if (targetSize_ > 0)
+    {
+      layerSizes.back() = (kdu_core::kdu_long)targetSize_;
+    }
+    else if (targetBitsPerPixel_ > 0.0f)
+    {
+      layerSizes.back() = (kdu_core::kdu_long)(targetBitsPerPixel_ * pixels / 8.0);
+    }
+    return layerSizes;
+  }
+
+  // encodes frames of the batch until there are none left, the first error is
+  // stored in pError and stops the other workers taking more frames
+  void encodeBatchFrames_(std::atomic<size_t> &nextFrame, std::exception_ptr *pError)
+  {
+    const size_t numFrames = batchEncoded_.size();
+    const size_t frameSize = getRowSize_(frameInfo_) * frameInfo_.height;
+    Session session;
+    try
+    {
+      // each worker has its own parameters, Kakadu codestreams are not safe to
+      // read from several threads at once
+      Config config;
+      prepare_(frameInfo_, config);
+      for (size_t frame = nextFrame++; frame < numFrames; frame = nextFrame++)
+      {
+        begin_(session, frameInfo_, config, new kdu_buffer_target(batchEncoded_[frame]), NULL);
+        push_(session, frameInfo_, decoded_.data() + frame * frameSize, frameInfo_.height);
+        finish_(session, frameInfo_);
+      }
+    }
+    catch (...)
+    {
+      abort_(session, true);
+      *pError = std::current_exception();
+      nextFrame = numFrames;
+    }
+  }
+
+  // starts recording the stats of an encode into session_
+  void statsBegin_()
+  {
+    stats_.begin("encode");
+    session_.pStats = &stats_;
+    statsCapacity_ = encoded_.capacity();
+  }
+
+  // completes the stats of the encode once finish_() returns
+  void statsEnd_()
+  {
+    if (!stats_.isEnabled())
+    {
+      return;
+    }
+    stats_.lap(stats_.stats().finishMs, "finish");
+    stats_.stats().bytes = encodedSize_;
+    stats_.buffer(statsCapacity_, encoded_.capacity(), pEncodedBuffer_ ? encodedSize_ : encoded_.size());
+    stats_.end();
+  }
+
+  kdu_buffer_target *createTarget_()
+  {
+    if (pEncodedBuffer_)
+    {
+      // the encoded buffer no longer holds the last encode
+      encoded_.clear();
+      return new kdu_buffer_target(pEncodedBuffer_, encodedBufferCapacity_);
+    }
+    return new kdu_buffer_target(encoded_);
+  }
+
+  // parses and finalizes the coding parameters for frameInfo into config.
+  // They are prepared once and copied into the codestream of each frame by
+  // begin_()
+  void prepare_(const FrameInfo &frameInfo, Config &config) const
+  {
+    kdu_core::siz_params siz;
+    siz.set(Scomponents, 0, 0, frameInfo.componentCount);
+    siz.set(Sdims, 0, 0, frameInfo.height);
+    siz.set(Sdims, 0, 1, frameInfo.width);
+    siz.set(Sprecision, 0, 0, frameInfo.bitsPerSample);
+    siz.set(Ssigned, 0, 0, frameInfo.isSigned);
+    if (tileSize_.width > 0 && tileSize_.height > 0)
+    {
+      siz.set(Stiles, 0, 0, (int)tileSize_.height);
+      siz.set(Stiles, 0, 1, (int)tileSize_.width);
+    }
+    kdu_core::kdu_params *siz_ref = &siz;
+    siz_ref->finalize();
+    config.codestream.create(&siz);
+    kdu_core::kdu_params *params = config.codestream.access_siz();
 
-    // Set up any specific coding parameters and finalize them.
     if (htEnabled_)
     {
-      codestream.access_siz()->parse_string("Cmodes=HT");
+      params->parse_string("Cmodes=HT");
     }
     char param[32];
     if (lossless_)
     {
-      codestream.access_siz()->parse_string("Creversible=yes");
+      params->parse_string("Creversible=yes");
     }
     else
     {
-      codestream.access_siz()->parse_string("Creversible=no");
+      params->parse_string("Creversible=no");
       snprintf(param, 32, "Qstep=%f", quantizationStep_);
-      codestream.access_siz()->parse_string(param);
+      params->parse_string(param);
     }
 
     switch (progressionOrder_)
     {
     case 0:
-      codestream.access_siz()->parse_string("Corder=LRCP");
+      params->parse_string("Corder=LRCP");
       break;
     case 1:
-      codestream.access_siz()->parse_string("Corder=RLCP");
+      params->parse_string("Corder=RLCP");
       break;
     case 2:
-      codestream.access_siz()->parse_string("Corder=RPCL");
+      params->parse_string("Corder=RPCL");
       break;
     case 3:
-      codestream.access_siz()->parse_string("Corder=PCRL");
+      params->parse_string("Corder=PCRL");
       break;
     case 4:
-      codestream.access_siz()->parse_string("Corder=CPRL");
+      params->parse_string("Corder=CPRL");
       break;
     }
 
     snprintf(param,32, "Clevels=%zu", decompositions_);
-    codestream.access_siz()->parse_string(param);
+    params->parse_string(param);
 
     snprintf(param, 32, "Cblk={%d,%d}", blockDimensions_.width, blockDimensions_.height);
-    codestream.access_siz()->parse_string(param);
-    codestream.access_siz()->finalize_all(); // Set up coding defaults
+    params->parse_string(param);
 
-    // Now compress the image in one hit, using `kdu_stripe_compressor'
-    kdu_supp::kdu_stripe_compressor compressor;
-    compressor.start(codestream);
-    int stripe_heights[3] = {frameInfo_.height, frameInfo_.height, frameInfo_.height};
-    if (frameInfo_.bitsPerSample <= 8)
+    if (precinctSize_.width > 0 && precinctSize_.height > 0)
     {
-      compressor.push_stripe(
-          decoded_.data(),
-          stripe_heights);
+      snprintf(param, 32, "Cprecincts={%d,%d}", precinctSize_.height, precinctSize_.width);
+      params->parse_string(param);
     }
-    else
+
+    // pointer markers, the TLM segment is rewritten once the tile lengths are
+    // known which the output target supports (see start_rewrite())
+    if (pltEnabled_)
+    {
+      params->parse_string("ORGgen_plt=yes");
+    }
+    if (tlmEnabled_)
+    {
+      params->parse_string("ORGgen_tlm=1");
+    }
+
+    // quality layers and their cumulative sizes in bytes for rate control
+    config.layerSizes = getLayerSizes_(frameInfo);
+    snprintf(param, 32, "Clayers=%zu", config.layerSizes.size());
+    params->parse_string(param);
+    params->finalize_all(); // Set up coding defaults
+  }
+
+  // creates the codestream for frameInfo with the coding parameters in config
+  // writing to pTarget (which the session takes ownership of) and starts the
+  // stripe compressor
+  void begin_(Session &session, const FrameInfo &frameInfo, const Config &config, kdu_buffer_target *pTarget, kdu_core::kdu_thread_env *env) const
+  {
+    session.pTarget.reset(pTarget);
+    session.env = env;
+    session.rowsPushed = 0;
+    kdu_core::kdu_codestream prepared = config.codestream;
+    kdu_core::siz_params *siz = prepared.access_siz();
+
+    kdu_core::kdu_compressed_target *pOutput = pTarget;
+    if (jp2Enabled_)
+    {
+      session.tgt.open(pTarget);
+      session.output.open(&session.tgt);
+      kdu_supp::jp2_dimensions dims = session.output.access_dimensions();
+      dims.init(siz);
+      kdu_supp::jp2_colour colr = session.output.access_colour();
+      colr.init((frameInfo.componentCount == 3) ? kdu_supp::JP2_sRGB_SPACE : kdu_supp::JP2_sLUM_SPACE);
+      session.output.write_header();
+      session.output.open_codestream(true);
+      pOutput = &session.output;
+    }
+
+    //  Construct code-stream object with a copy of the prepared parameters
+    kdu_core::kdu_codestream &codestream = session.codestream;
+    codestream.create(siz, pOutput);
+    if (session.pStats && session.pStats->isEnabled())
     {
-      bool is_signed[3] = {frameInfo_.isSigned, frameInfo_.isSigned, frameInfo_.isSigned};
-      int precisions[3] = {frameInfo_.bitsPerSample, frameInfo_.bitsPerSample, frameInfo_.bitsPerSample};
-      compressor.push_stripe(
-          (kdu_core::kdu_int16 *)decoded_.data(),
-          stripe_heights,
-          NULL,
-          NULL,
-          NULL,
-          precisions,
-          is_signed);
+      codestream.collect_timing_stats(1);
+    }
+
+    // Now start the `kdu_stripe_compressor', the image is pushed to it by push_()
+    try
+    {
+      codestream.access_siz()->copy_all(siz);
+      codestream.access_siz()->finalize_all();
+      session.pCompressor.reset(new kdu_supp::kdu_stripe_compressor());
+      session.pCompressor->start(codestream,
+                                 (int)config.layerSizes.size(), // num_layer_specs
+                                 config.layerSizes.data(),      // layer_sizes
+                                 NULL,  // layer_slopes
+                                 0,     // min_slope_threshold
+                                 false, // no_auto_complexity_control
+                                 false, // force_precise
+                                 true,  // record_layer_info_in_comment
+                                 0.0,   // size_tolerance
+                                 0,     // num_components
+                                 false, // want_fastest
+                                 env);
+    }
+    catch (...)
+    {
+      abort_(session, true);
+      throw;
+    }
+  }
+
+  // compresses the next numRows rows of pixel data
+  void push_(Session &session, const FrameInfo &frameInfo, const uint8_t *pRows, size_t numRows) const
+  {
+    if (!session.codestream.exists())
+    {
+      throw "no encode in progress";
+    }
+    if (session.rowsPushed + numRows > frameInfo.height)
+    {
+      throw "more rows pushed than the height of the image";
+    }
+    try
+    {
+      int stripe_heights[maxComponents_];
+      bool is_signed[maxComponents_];
+      int precisions[maxComponents_];
+      for (size_t c = 0; c < frameInfo.componentCount; c++)
+      {
+        stripe_heights[c] = (int)numRows;
+        is_signed[c] = frameInfo.isSigned;
+        precisions[c] = frameInfo.bitsPerSample;
+      }
+      if (frameInfo.bitsPerSample <= 8)
+      {
+        session.pCompressor->push_stripe(
+            (kdu_core::kdu_byte *)pRows,
+            stripe_heights);
+      }
+      else
+      {
+        session.pCompressor->push_stripe(
+            (kdu_core::kdu_int16 *)pRows,
+            stripe_heights,
+            NULL,
+            NULL,
+            NULL,
+            precisions,
+            is_signed);
+      }
+    }
+    catch (...)
+    {
+      abort_(session, true);
+      throw;
+    }
+    session.rowsPushed += numRows;
+  }
+
+  // flushes the codestream once all rows have been pushed and returns the
+  // number of bytes written to the target
+  size_t finish_(Session &session, const FrameInfo &frameInfo) const
+  {
+    if (!session.codestream.exists())
+    {
+      throw "no encode in progress";
+    }
+    if (session.rowsPushed != frameInfo.height)
+    {
+      abort_(session, false);
+      throw "not all rows of the image were pushed";
+    }
+    try
+    {
+      session.pCompressor->finish();
+    }
+    catch (...)
+    {
+      abort_(session, true);
+      throw;
+    }
+    ThreadEnv::terminate(session.env, session.codestream);
+    if (session.pStats)
+    {
+      session.pStats->codestream(session.codestream);
     }
-    compressor.finish();
 
     // Finally, cleanup
-    codestream.destroy();
-    tgt.close();
-    output.close();
-    target.close();
+    session.pCompressor.reset();
+    session.codestream.destroy();
+    if (jp2Enabled_)
+    {
+      session.output.close();
+      session.tgt.close();
+    }
+    session.pTarget->close();
+    const size_t encodedSize = session.pTarget->size();
+    session.pTarget.reset();
+    return encodedSize;
+  }
+
+  // abandons the encode in progress (if any), failed is true if it is being
+  // abandoned because an exception was thrown
+  void abort_(Session &session, bool failed) const
+  {
+    if (!session.codestream.exists())
+    {
+      return;
+    }
+    // let the thread environment recover before the codestream is destroyed
+    if (failed)
+    {
+      ThreadEnv::recover(session.env);
+    }
+    else
+    {
+      ThreadEnv::terminate(session.env, session.codestream);
+    }
+    session.pCompressor.reset();
+    session.codestream.destroy();
+    if (jp2Enabled_)
+    {
+      session.output.close();
+      session.tgt.close();
+    }
+    session.pTarget.reset();
   }
 
-private:
   std::vector<uint8_t> decoded_;
   std::vector<uint8_t> encoded_;
+  std::vector<uint8_t> stripe_;
+  std::vector<std::vector<uint8_t>> batchEncoded_;
+  Session session_;
   FrameInfo frameInfo_;
   size_t decompositions_;
   bool lossless_;
@@ -286,4 +1099,19 @@ private:
   size_t progressionOrder_;
   Size blockDimensions_;
   bool htEnabled_;
+  Size tileSize_;
+  Size precinctSize_;
+  bool pltEnabled_;
+  bool tlmEnabled_;
+  size_t numLayers_;
+  size_t targetSize_;
+  float targetBitsPerPixel_;
+  std::vector<float> layerBitsPerPixel_;
+  bool jp2Enabled_;
+  uint8_t *pEncodedBuffer_;
+  size_t encodedBufferCapacity_;
+  size_t encodedSize_;
+  StatsRecorder stats_;
+  size_t statsCapacity_;
+  ThreadEnv threadEnv_;
 };
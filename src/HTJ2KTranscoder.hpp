@@ -0,0 +1,301 @@
+// Copyright (c) Chris Hafey.
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+// Kakadu core includes
+#include "kdu_elementary.h"
+#include "kdu_messaging.h"
+#include "kdu_params.h"
+#include "kdu_compressed.h"
+#include "kdu_block_coding.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#ifdef __EMSCRIPTEN__
+#include <emscripten/val.h>
+#endif
+
+#include "CodestreamIndex.hpp"
+#include "HTJ2KEncoder.hpp" // kdu_buffer_target
+
+/// <summary>
+/// Transcodes a JPEG 2000 Part 1 codestream to HTJ2K by re-coding every
+/// code-block with the HT block coder.  The wavelet coefficients are recovered
+/// by the block decoder only, there is no dequantization, inverse DWT or
+/// colour transform, so the coded magnitude bits of every coefficient are
+/// carried over exactly and it is much faster than a full decode and encode.
+/// The SIZ, COD, QCD, tiling, precincts and progression order of the source
+/// are kept, the quality layers are collapsed to one since the HT block coder
+/// produces a single set of coding passes.  Code-blocks that hold all of their
+/// coding passes, or were truncated after a cleanup pass, decode to exactly
+/// the same samples after transcoding.  A code-block truncated after a
+/// significance propagation or magnitude refinement pass has only part of its
+/// last bit-plane, which the HT cleanup pass cannot express, so that partial
+/// bit-plane is dropped.
+/// </summary>
+class HTJ2KTranscoder
+{
+public:
+  /// <summary>
+  /// Constructor for transcoding from JavaScript.
+  /// </summary>
+  HTJ2KTranscoder()
+  {
+  }
+
+#ifdef __EMSCRIPTEN__
+  /// <summary>
+  /// Resizes the source buffer and returns a TypedArray of the buffer
+  /// allocated in WASM memory space that will hold the J2K (or JP2) encoded
+  /// bitstream to transcode.  JavaScript code needs to copy the bitstream into
+  /// the returned TypedArray
+  /// </summary>
+  /// <param name="sourceSize">Size of the J2K bitstream in bytes</param>
+  emscripten::val getSourceBuffer(size_t sourceSize)
+  {
+    source_.resize(sourceSize);
+    return emscripten::val(emscripten::typed_memory_view(source_.size(), source_.data()));
+  }
+
+  /// <summary>
+  /// Returns a TypedArray of the buffer allocated in WASM memory space that
+  /// holds the HTJ2K codestream produced by transcode()
+  /// </summary>
+  emscripten::val getTranscodedBuffer()
+  {
+    return emscripten::val(emscripten::typed_memory_view(transcoded_.size(), transcoded_.data()));
+  }
+#else
+  /// <summary>
+  /// Returns the buffer to store the J2K (or JP2) bitstream to transcode.
+  /// This method is not exported to JavaScript, it is intended to be called
+  /// by C++ code
+  /// </summary>
+  std::vector<uint8_t> &getSourceBytes()
+  {
+    return source_;
+  }
+
+  /// <summary>
+  /// Returns the HTJ2K codestream produced by transcode().  This method is not
+  /// exported to JavaScript, it is intended to be called by C++ code
+  /// </summary>
+  const std::vector<uint8_t> &getTranscodedBytes() const
+  {
+    return transcoded_;
+  }
+#endif
+
+  /// <summary>
+  /// Transcodes the source bitstream to a raw HTJ2K codestream (j2c).  A JP2
+  /// source is accepted but only its codestream is transcoded.  Codestreams
+  /// that already use the HT block coder are re-coded too.
+  /// </summary>
+  void transcode()
+  {
+    const size_t offset = CodestreamIndex::findCodestream(source_.data(), source_.size());
+    if (offset >= source_.size())
+    {
+      throw "no codestream found in the source buffer";
+    }
+    kdu_core::kdu_compressed_source_buffered source(source_.data() + offset, source_.size() - offset);
+    kdu_buffer_target target(transcoded_);
+    kdu_core::kdu_codestream input;
+    kdu_core::kdu_codestream output;
+    try
+    {
+      input.create(&source);
+      output.create(input.access_siz(), &target);
+      output.access_siz()->copy_all(input.access_siz());
+      setHTModes_(output);
+      output.access_siz()->finalize_all();
+
+      kdu_core::kdu_dims tiles;
+      input.get_valid_tiles(tiles);
+      kdu_core::kdu_coords index;
+      for (index.y = 0; index.y < tiles.size.y; index.y++)
+      {
+        for (index.x = 0; index.x < tiles.size.x; index.x++)
+        {
+          kdu_core::kdu_tile tileIn = input.open_tile(index + tiles.pos);
+          kdu_core::kdu_tile tileOut = output.open_tile(index + tiles.pos);
+          transcodeTile_(tileIn, tileOut);
+          tileIn.close();
+          tileOut.close();
+        }
+      }
+
+      kdu_core::kdu_long layerBytes = 0; // everything in the single layer
+      output.flush(&layerBytes, 1);
+    }
+    catch (...)
+    {
+      if (output.exists())
+      {
+        output.destroy();
+      }
+      if (input.exists())
+      {
+        input.destroy();
+      }
+      source.close();
+      target.close();
+      transcoded_.clear();
+      throw;
+    }
+    output.destroy();
+    input.destroy();
+    source.close();
+    target.close();
+  }
+
+private:
+  // switches every COD/COC record that sets Cmodes explicitly (the main
+  // header always does after copy_all) to the HT block coder and collapses
+  // the quality layers to one.  The Part 1 coding pass modes (BYPASS, RESET,
+  // ...) only apply to the EBCOT coder so they are dropped
+  static void setHTModes_(kdu_core::kdu_codestream &output)
+  {
+    kdu_core::kdu_params *cod = output.access_siz()->access_cluster(COD_params);
+    kdu_core::kdu_dims tiles;
+    output.get_valid_tiles(tiles);
+    const int numTiles = (int)tiles.area();
+    const int numComponents = output.get_num_components();
+    for (int t = -1; t < numTiles; t++)
+    {
+      for (int c = -1; c < numComponents; c++)
+      {
+        kdu_core::kdu_params *relation = cod->access_relation(t, c, 0, false);
+        if (relation == NULL)
+        {
+          continue;
+        }
+        int value;
+        if ((t < 0 && c < 0) || relation->get(Cmodes, 0, 0, value, false))
+        {
+          relation->set(Cmodes, 0, 0, Cmodes_HT);
+        }
+        if ((t < 0 && c < 0) || relation->get(Clayers, 0, 0, value, false))
+        {
+          relation->set(Clayers, 0, 0, 1);
+        }
+      }
+    }
+  }
+
+  // re-codes every code-block of a tile.  The two tiles have identical
+  // structure since the output parameters are copied from the input
+  void transcodeTile_(kdu_core::kdu_tile &tileIn, kdu_core::kdu_tile &tileOut)
+  {
+    const int numComponents = tileIn.get_num_components();
+    for (int c = 0; c < numComponents; c++)
+    {
+      kdu_core::kdu_tile_comp compIn = tileIn.access_component(c);
+      kdu_core::kdu_tile_comp compOut = tileOut.access_component(c);
+      const int numResolutions = compIn.get_num_resolutions();
+      for (int r = 0; r < numResolutions; r++)
+      {
+        kdu_core::kdu_resolution resIn = compIn.access_resolution(r);
+        kdu_core::kdu_resolution resOut = compOut.access_resolution(r);
+        int minBand;
+        const int numBands = resIn.get_valid_band_indices(minBand);
+        for (int b = minBand; b < minBand + numBands; b++)
+        {
+          kdu_core::kdu_subband bandIn = resIn.access_subband(b);
+          kdu_core::kdu_subband bandOut = resOut.access_subband(b);
+          transcodeBand_(bandIn, bandOut);
+        }
+      }
+    }
+  }
+
+  // re-codes every code-block of a subband with exactly the magnitude bits
+  // coded in the source, see codedMagnitudes_()
+  void transcodeBand_(kdu_core::kdu_subband &bandIn, kdu_core::kdu_subband &bandOut)
+  {
+    const bool reversible = bandOut.get_reversible();
+    const double msbWmse = bandOut.get_msb_wmse();
+    kdu_core::kdu_dims blocks;
+    bandIn.get_valid_blocks(blocks);
+    kdu_core::kdu_coords index;
+    for (index.y = 0; index.y < blocks.size.y; index.y++)
+    {
+      for (index.x = 0; index.x < blocks.size.x; index.x++)
+      {
+        kdu_core::kdu_block *in = bandIn.open_block(index + blocks.pos);
+        kdu_core::kdu_block *out = bandOut.open_block(index + blocks.pos);
+        if (in->size != out->size || in->K_max_prime != out->K_max_prime)
+        {
+          bandIn.close_block(in);
+          bandOut.close_block(out);
+          throw "code-block structure of the transcoded codestream does not match the source";
+        }
+        out->num_passes = 0; // empty block, nothing to code
+        if (in->num_passes > 0)
+        {
+          // the block coders work on stripes of 4 rows
+          const int numSamples = ((in->size.y + 3) & ~3) * in->size.x;
+          in->set_max_samples(numSamples);
+          decoder_.decode(in);
+          out->set_max_samples(numSamples);
+          const int numPlanes = codedPlanes_(in);
+          if (codedMagnitudes_(in, numPlanes, out->sample_buffer, numSamples))
+          {
+            // the magnitudes have the same leading zero bit-planes.  Limiting
+            // the encoder to the bit-planes the source coded makes the HT
+            // cleanup pass end on the same bit-plane, so the decoder
+            // reconstructs the samples exactly as it does for the source
+            out->missing_msbs = in->missing_msbs;
+            const int K_max_prime = out->K_max_prime;
+            out->K_max_prime = numPlanes;
+            encoder_.encode(out, reversible, msbWmse, 0);
+            out->K_max_prime = K_max_prime;
+          }
+        }
+        bandIn.close_block(in);
+        bandOut.close_block(out);
+      }
+    }
+  }
+
+  // returns the number of most significant bit-planes (including the
+  // missing_msbs ones) the source block coded completely.  Part 1 blocks have
+  // a cleanup pass for the first coded bit-plane and a significance
+  // propagation, magnitude refinement and cleanup pass for each of the
+  // others.  HT blocks count their passes the same way (including placeholder
+  // passes)
+  static int codedPlanes_(const kdu_core::kdu_block *in)
+  {
+    const int cleanupPlanes = (in->num_passes + 2) / 3;
+    return in->missing_msbs + std::min(cleanupPlanes, in->K_max_prime - in->missing_msbs);
+  }
+
+  // copies the top numPlanes magnitude bit-planes of the decoded block in to
+  // samples and returns false if they are all zero.  The decoder reconstructs
+  // each non-zero sample at the middle of its uncertainty interval by setting
+  // the bit below the last bit-plane decoded, and a block truncated after a
+  // refinement pass has bits of a partial bit-plane, neither of which is
+  // re-encoded
+  static bool codedMagnitudes_(const kdu_core::kdu_block *in, int numPlanes, kdu_core::kdu_int32 *samples, int numSamples)
+  {
+    // the most significant bit-plane is bit 30
+    const uint32_t planeMask = 0x7FFFFFFFu & (0xFFFFFFFFu << (31 - numPlanes));
+    uint32_t any = 0;
+    for (int i = 0; i < numSamples; i++)
+    {
+      const uint32_t sample = (uint32_t)in->sample_buffer[i];
+      const uint32_t magnitude = sample & planeMask;
+      samples[i] = magnitude ? (kdu_core::kdu_int32)((sample & 0x80000000u) | magnitude) : 0;
+      any |= magnitude;
+    }
+    return any != 0;
+  }
+
+  std::vector<uint8_t> source_;
+  std::vector<uint8_t> transcoded_;
+  kdu_core::kdu_block_decoder decoder_;
+  kdu_core::kdu_block_encoder encoder_;
+};
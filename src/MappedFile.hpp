@@ -0,0 +1,139 @@
+// Copyright (c) Chris Hafey.
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+/// <summary>
+/// Read only memory mapping of a whole file, see
+/// HTJ2KDecoder::setEncodedFile().  The pages are only read from disk as they
+/// are accessed and are shared with the page cache, so the file is never
+/// copied into the process heap
+/// </summary>
+class MappedFile
+{
+public:
+  MappedFile() : data_(NULL),
+                 size_(0)
+  {
+  }
+
+  ~MappedFile()
+  {
+    close();
+  }
+
+  /// <summary>
+  /// Maps the file at path, unmapping any previously mapped file.  Throws if
+  /// the file cannot be opened or mapped
+  /// </summary>
+  void open(const char *path)
+  {
+    close();
+#ifdef _WIN32
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE)
+    {
+      throw "unable to open the file to map";
+    }
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(file, &fileSize))
+    {
+      CloseHandle(file);
+      throw "unable to get the size of the file to map";
+    }
+    if (fileSize.QuadPart > 0)
+    {
+      HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+      void *data = mapping ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : NULL;
+      if (mapping)
+      {
+        CloseHandle(mapping); // the view keeps the mapping alive
+      }
+      if (data == NULL)
+      {
+        CloseHandle(file);
+        throw "unable to map the file";
+      }
+      data_ = (const uint8_t *)data;
+    }
+    CloseHandle(file);
+    size_ = (size_t)fileSize.QuadPart;
+#else
+    const int fd = ::open(path, O_RDONLY);
+    if (fd < 0)
+    {
+      throw "unable to open the file to map";
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0)
+    {
+      ::close(fd);
+      throw "unable to get the size of the file to map";
+    }
+    if (st.st_size > 0)
+    {
+      void *data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (data == MAP_FAILED)
+      {
+        ::close(fd);
+        throw "unable to map the file";
+      }
+      data_ = (const uint8_t *)data;
+    }
+    ::close(fd); // the mapping stays valid after the descriptor is closed
+    size_ = (size_t)st.st_size;
+#endif
+  }
+
+  /// <summary>
+  /// Unmaps the file, if any
+  /// </summary>
+  void close()
+  {
+    if (data_)
+    {
+#ifdef _WIN32
+      UnmapViewOfFile(data_);
+#else
+      munmap((void *)data_, size_);
+#endif
+    }
+    data_ = NULL;
+    size_ = 0;
+  }
+
+  /// <summary>
+  /// Returns the mapped bytes, NULL if no file (or an empty file) is mapped
+  /// </summary>
+  const uint8_t *data() const
+  {
+    return data_;
+  }
+
+  /// <summary>
+  /// Returns the size of the mapped file in bytes
+  /// </summary>
+  size_t size() const
+  {
+    return size_;
+  }
+
+private:
+  MappedFile(const MappedFile &);
+  MappedFile &operator=(const MappedFile &);
+
+  const uint8_t *data_;
+  size_t size_;
+};
@@ -0,0 +1,38 @@
+// Copyright (c) Chris Hafey.
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+/// <summary>
+/// The sample format of the decoded buffer, see
+/// HTJ2KDecoder::setOutputFormat()
+/// </summary>
+enum OutputFormat {
+    /// <summary>
+    /// The components interleaved at the bit depth of the image, one byte per
+    /// sample up to 8 bits and two bytes otherwise
+    /// </summary>
+    OUTPUT_NATIVE = 0,
+
+    /// <summary>
+    /// Four bytes per pixel (red, green, blue, alpha) as used by canvas
+    /// ImageData and RGBA8 textures.  Grayscale is expanded with the palette
+    /// </summary>
+    OUTPUT_RGBA = 1
+};
+
+/// <summary>
+/// The arrangement of the components in the decoded buffer, see
+/// HTJ2KDecoder::setOutputLayout()
+/// </summary>
+enum OutputLayout {
+    /// <summary>
+    /// The samples of each pixel are stored together (RGBRGB...)
+    /// </summary>
+    LAYOUT_INTERLEAVED = 0,
+
+    /// <summary>
+    /// Each component is stored as a separate plane (RRR...GGG...BBB...)
+    /// </summary>
+    LAYOUT_PLANAR = 1
+};
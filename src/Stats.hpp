@@ -0,0 +1,246 @@
+// Copyright (c) Chris Hafey.
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "kdu_compressed.h"
+
+/// <summary>
+/// Statistics for the last decode or encode call, see setStatsEnabled().
+/// Times are in milliseconds of wall clock time.
+/// </summary>
+struct Stats {
+    Stats() : headerMs(0), startMs(0), processMs(0), blockCoderMs(0), outputMs(0), finishMs(0), totalMs(0),
+              bytes(0), samples(0), allocations(0), peakBufferSize(0), peakCodestreamMemory(0) {}
+
+    /// <summary>
+    /// Parsing the main header (decode only, 0 if readHeader() already did)
+    /// </summary>
+    double headerMs;
+
+    /// <summary>
+    /// Starting the stripe decompressor / compressor (opening tiles and
+    /// allocating the sample processing machinery).  For an encode this also
+    /// includes creating the codestream and its coding parameters
+    /// </summary>
+    double startMs;
+
+    /// <summary>
+    /// Pulling / pushing the stripes, i.e. block decoding / encoding, the DWT
+    /// and sample conversion
+    /// </summary>
+    double processMs;
+
+    /// <summary>
+    /// The part of processMs spent in the block coder as measured by Kakadu
+    /// (summed over all threads)
+    /// </summary>
+    double blockCoderMs;
+
+    /// <summary>
+    /// Time spent in stripe callbacks (decodeStripes() only)
+    /// </summary>
+    double outputMs;
+
+    /// <summary>
+    /// Finishing the decompressor / flushing the codestream
+    /// </summary>
+    double finishMs;
+
+    /// <summary>
+    /// The whole call (from beginEncode() to finishEncode() for a streaming
+    /// encode)
+    /// </summary>
+    double totalMs;
+
+    /// <summary>
+    /// Compressed bytes consumed (decode) or produced (encode)
+    /// </summary>
+    size_t bytes;
+
+    /// <summary>
+    /// Number of samples processed by the block coder
+    /// </summary>
+    size_t samples;
+
+    /// <summary>
+    /// Number of times a kakadujs buffer (decoded, encoded or stripe) had to be
+    /// reallocated to grow
+    /// </summary>
+    size_t allocations;
+
+    /// <summary>
+    /// Size of the largest kakadujs buffer used
+    /// </summary>
+    size_t peakBufferSize;
+
+    /// <summary>
+    /// Peak memory Kakadu used for compressed data and codestream state
+    /// </summary>
+    size_t peakCodestreamMemory;
+};
+
+/// <summary>
+/// Records Stats for the calls of a decoder or encoder and optionally Chrome
+/// trace events (chrome://tracing, Perfetto) for a sequence of calls.  Every
+/// method returns immediately when disabled so the cost is a branch per phase.
+/// </summary>
+class StatsRecorder
+{
+public:
+    StatsRecorder() : enabled_(false), traceEnabled_(false), call_(""), origin_(std::chrono::steady_clock::now()) {}
+
+    void setEnabled(bool enabled)
+    {
+        enabled_ = enabled;
+    }
+
+    bool isEnabled() const
+    {
+        return enabled_;
+    }
+
+    // trace events are collected until clearTrace() while enabled
+    void setTraceEnabled(bool traceEnabled)
+    {
+        traceEnabled_ = traceEnabled;
+    }
+
+    const Stats &getStats() const
+    {
+        return stats_;
+    }
+
+    Stats &stats()
+    {
+        return stats_;
+    }
+
+    // starts recording a call named call, resetting the stats
+    void begin(const char *call)
+    {
+        if (!enabled_)
+        {
+            return;
+        }
+        stats_ = Stats();
+        call_ = call;
+        callStart_ = lapStart_ = std::chrono::steady_clock::now();
+    }
+
+    // adds the time since the previous lap (or begin()) to phaseMs
+    void lap(double &phaseMs, const char *phase)
+    {
+        if (!enabled_)
+        {
+            return;
+        }
+        const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        phaseMs += std::chrono::duration<double, std::milli>(now - lapStart_).count();
+        addTraceEvent_(phase, lapStart_, now);
+        lapStart_ = now;
+    }
+
+    // records a kakadujs buffer, capacityBefore is its capacity before the call
+    void buffer(size_t capacityBefore, size_t capacityAfter, size_t size)
+    {
+        if (!enabled_)
+        {
+            return;
+        }
+        if (capacityAfter > capacityBefore)
+        {
+            stats_.allocations++;
+        }
+        stats_.peakBufferSize = std::max(stats_.peakBufferSize, size);
+    }
+
+    // restarts the lap timer without recording, used when a call spans several
+    // methods so the time spent by the caller in between is not counted
+    void resume()
+    {
+        if (!enabled_)
+        {
+            return;
+        }
+        lapStart_ = std::chrono::steady_clock::now();
+    }
+
+    // records the block coder timing and memory use of codestream, which must
+    // have been created with collect_timing_stats() enabled, see isEnabled()
+    void codestream(kdu_core::kdu_codestream &codestream)
+    {
+        if (!enabled_)
+        {
+            return;
+        }
+        kdu_core::kdu_long samples = 0;
+        stats_.blockCoderMs = 1000.0 * codestream.get_timing_stats(&samples, true);
+        stats_.samples = (size_t)samples;
+        stats_.peakCodestreamMemory = (size_t)(codestream.get_compressed_data_memory() + codestream.get_compressed_state_memory());
+    }
+
+    // completes the call started by begin()
+    void end()
+    {
+        if (!enabled_)
+        {
+            return;
+        }
+        const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        stats_.totalMs = std::chrono::duration<double, std::milli>(now - callStart_).count();
+        addTraceEvent_(NULL, callStart_, now);
+    }
+
+    // returns the trace events collected so far in the Chrome trace event format
+    std::string getTraceJson() const
+    {
+        std::string json = "{\"traceEvents\":[";
+        for (size_t i = 0; i < trace_.size(); i++)
+        {
+            if (i > 0)
+            {
+                json += ",";
+            }
+            json += trace_[i];
+        }
+        json += "]}";
+        return json;
+    }
+
+    void clearTrace()
+    {
+        trace_.clear();
+    }
+
+private:
+    // complete ("X") events, the phases are nested in the call by time
+    void addTraceEvent_(const char *phase, std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point end)
+    {
+        if (!traceEnabled_)
+        {
+            return;
+        }
+        char event[256];
+        snprintf(event, sizeof(event), "{\"name\":\"%s%s%s\",\"cat\":\"kakadujs\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":1}",
+                 call_, phase ? "." : "", phase ? phase : "",
+                 std::chrono::duration<double, std::micro>(start - origin_).count(),
+                 std::chrono::duration<double, std::micro>(end - start).count());
+        trace_.push_back(event);
+    }
+
+    bool enabled_;
+    bool traceEnabled_;
+    const char *call_;
+    Stats stats_;
+    std::chrono::steady_clock::time_point origin_;
+    std::chrono::steady_clock::time_point callStart_;
+    std::chrono::steady_clock::time_point lapStart_;
+    std::vector<std::string> trace_;
+};
@@ -0,0 +1,134 @@
+// Copyright (c) Chris Hafey.
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include <cstddef>
+
+#include "kdu_compressed.h"
+#include "kdu_sample_processing.h"
+
+/// <summary>
+/// The Kakadu thread environment of a decoder or encoder.  The environment
+/// is created with getNumThreads() threads (including the calling thread) on
+/// first use and kept alive for reuse until the number of threads changes.
+/// A caller owned environment set with setExternal() takes precedence.  When
+/// Kakadu was built without threading (KDU_NO_THREADS) there is never an
+/// environment.
+/// </summary>
+class ThreadEnv
+{
+public:
+    ThreadEnv() : numThreads_(0)
+#ifndef KDU_NO_THREADS
+                  ,
+                  pExternal_(NULL)
+#endif
+    {
+    }
+
+    ~ThreadEnv()
+    {
+#ifndef KDU_NO_THREADS
+        if (env_.exists())
+        {
+            env_.destroy();
+        }
+#endif
+    }
+
+    void setNumThreads(size_t numThreads)
+    {
+#ifndef KDU_NO_THREADS
+        if (numThreads != numThreads_ && env_.exists())
+        {
+            env_.destroy();
+        }
+#endif
+        numThreads_ = numThreads;
+    }
+
+    size_t getNumThreads() const
+    {
+        return numThreads_;
+    }
+
+#ifndef KDU_NO_THREADS
+    void setExternal(kdu_core::kdu_thread_env *pExternal)
+    {
+        pExternal_ = pExternal;
+    }
+
+    bool isExternal() const
+    {
+        return pExternal_ != NULL;
+    }
+#else
+    bool isExternal() const
+    {
+        return false;
+    }
+#endif
+
+    // returns the environment to code with, NULL to code on the calling thread
+    kdu_core::kdu_thread_env *get()
+    {
+#ifdef KDU_NO_THREADS
+        return NULL;
+#else
+        if (pExternal_)
+        {
+            return pExternal_;
+        }
+        if (numThreads_ <= 1)
+        {
+            return NULL;
+        }
+        if (!env_.exists())
+        {
+            env_.create();
+            for (size_t thread = 1; thread < numThreads_; thread++)
+            {
+                if (!env_.add_thread())
+                {
+                    break;
+                }
+            }
+        }
+        return &env_;
+#endif
+    }
+
+    // waits for the work env did on codestream, call before destroying it
+    static void terminate(kdu_core::kdu_thread_env *env, kdu_core::kdu_codestream &codestream)
+    {
+#ifndef KDU_NO_THREADS
+        if (env)
+        {
+            env->cs_terminate(codestream);
+        }
+#endif
+    }
+
+    // lets env recover from an exception thrown while coding, call before
+    // destroying the codestream
+    static void recover(kdu_core::kdu_thread_env *env)
+    {
+#ifndef KDU_NO_THREADS
+        if (env)
+        {
+            env->handle_exception(-1);
+        }
+#endif
+    }
+
+private:
+    size_t numThreads_;
+#ifndef KDU_NO_THREADS
+    kdu_core::kdu_thread_env *pExternal_;
+    kdu_core::kdu_thread_env env_;
+#endif
+
+    ThreadEnv(const ThreadEnv &);
+    ThreadEnv &operator=(const ThreadEnv &);
+};
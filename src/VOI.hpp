@@ -0,0 +1,57 @@
+// Copyright (c) Chris Hafey.
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+/// <summary>
+/// The VOI LUT functions of DICOM PS3.3 C.11.2.1.2
+/// </summary>
+enum VOIFunction {
+    /// <summary>
+    /// LINEAR, the default DICOM window
+    /// </summary>
+    VOI_LINEAR = 0,
+
+    /// <summary>
+    /// LINEAR_EXACT, the window spans exactly windowWidth values
+    /// </summary>
+    VOI_LINEAR_EXACT = 1,
+
+    /// <summary>
+    /// SIGMOID
+    /// </summary>
+    VOI_SIGMOID = 2
+};
+
+/// <summary>
+/// Maps the decoded samples to 8 bits for display, see
+/// HTJ2KDecoder::decodeVOI().  The modality LUT (rescale slope and intercept)
+/// is applied first followed by the VOI window.
+/// </summary>
+struct VOI {
+    /// <summary>
+    /// Window center in modality units (e.g. Hounsfield units)
+    /// </summary>
+    double windowCenter;
+
+    /// <summary>
+    /// Window width in modality units, must be >= 1 for VOI_LINEAR and > 0
+    /// otherwise
+    /// </summary>
+    double windowWidth;
+
+    /// <summary>
+    /// Rescale slope, 1 if the image has no modality LUT
+    /// </summary>
+    double rescaleSlope;
+
+    /// <summary>
+    /// Rescale intercept, 0 if the image has no modality LUT
+    /// </summary>
+    double rescaleIntercept;
+
+    /// <summary>
+    /// The VOI LUT function
+    /// </summary>
+    VOIFunction voiFunction;
+};
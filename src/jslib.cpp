@@ -3,9 +3,13 @@
 
 #include "HTJ2KDecoder.hpp"
 #include "HTJ2KEncoder.hpp"
+#include "HTJ2KTranscoder.hpp"
 
 #include <emscripten.h>
 #include <emscripten/bind.h>
+#include <emscripten/heap.h>
+#include <malloc.h>
+#include <unistd.h>
 
 using namespace emscripten;
 
@@ -15,9 +19,44 @@ static std::string getVersion()
   return version;
 }
 
+/// <summary>
+/// WASM heap usage in bytes, see getHeapStats()
+/// </summary>
+struct HeapStats
+{
+  size_t heapSize;  // size of the WASM memory, it only ever grows
+  size_t heapUsed;  // bytes currently allocated by malloc/new
+  size_t heapBreak; // the program break, see getHeapStats()
+};
+
+// mallinfo() walks the heap so it is only called on demand rather than
+// sampled after every decode.  The allocator takes memory with sbrk() and
+// never returns it, so the program break (sbrk(0)) only grows.  It is an
+// upper bound on the peak of heapUsed since startup, including peaks reached
+// inside a decode or encode, but not the peak itself: it counts from address
+// 0 so it also includes the static data and stack below the heap and any
+// fragmentation
+static HeapStats getHeapStats()
+{
+  HeapStats stats;
+  stats.heapSize = emscripten_get_heap_size();
+  stats.heapUsed = mallinfo().uordblks;
+  stats.heapBreak = (size_t)sbrk(0);
+  return stats;
+}
+
 EMSCRIPTEN_BINDINGS(charlsjs)
 {
   function("getVersion", &getVersion);
+  function("getHeapStats", &getHeapStats);
+}
+
+EMSCRIPTEN_BINDINGS(HeapStats)
+{
+  value_object<HeapStats>("HeapStats")
+      .field("heapSize", &HeapStats::heapSize)
+      .field("heapUsed", &HeapStats::heapUsed)
+      .field("heapBreak", &HeapStats::heapBreak);
 }
 
 EMSCRIPTEN_BINDINGS(FrameInfo)
@@ -30,6 +69,41 @@ EMSCRIPTEN_BINDINGS(FrameInfo)
       .field("isSigned", &FrameInfo::isSigned);
 }
 
+EMSCRIPTEN_BINDINGS(OutputFormat)
+{
+  enum_<OutputFormat>("OutputFormat")
+      .value("NATIVE", OUTPUT_NATIVE)
+      .value("RGBA", OUTPUT_RGBA);
+
+  enum_<OutputLayout>("OutputLayout")
+      .value("INTERLEAVED", LAYOUT_INTERLEAVED)
+      .value("PLANAR", LAYOUT_PLANAR);
+}
+
+EMSCRIPTEN_BINDINGS(VOI)
+{
+  enum_<VOIFunction>("VOIFunction")
+      .value("LINEAR", VOI_LINEAR)
+      .value("LINEAR_EXACT", VOI_LINEAR_EXACT)
+      .value("SIGMOID", VOI_SIGMOID);
+
+  value_object<VOI>("VOI")
+      .field("windowCenter", &VOI::windowCenter)
+      .field("windowWidth", &VOI::windowWidth)
+      .field("rescaleSlope", &VOI::rescaleSlope)
+      .field("rescaleIntercept", &VOI::rescaleIntercept)
+      .field("voiFunction", &VOI::voiFunction);
+}
+
+EMSCRIPTEN_BINDINGS(ByteRange)
+{
+  value_object<ByteRange>("ByteRange")
+      .field("offset", &ByteRange::offset)
+      .field("length", &ByteRange::length);
+
+  register_vector<ByteRange>("ByteRangeVector");
+}
+
 EMSCRIPTEN_BINDINGS(Point)
 {
   value_object<Point>("Point")
@@ -44,36 +118,129 @@ EMSCRIPTEN_BINDINGS(Size)
       .field("height", &Size::height);
 }
 
+EMSCRIPTEN_BINDINGS(Stats)
+{
+  value_object<Stats>("Stats")
+      .field("headerMs", &Stats::headerMs)
+      .field("startMs", &Stats::startMs)
+      .field("processMs", &Stats::processMs)
+      .field("blockCoderMs", &Stats::blockCoderMs)
+      .field("outputMs", &Stats::outputMs)
+      .field("finishMs", &Stats::finishMs)
+      .field("totalMs", &Stats::totalMs)
+      .field("bytes", &Stats::bytes)
+      .field("samples", &Stats::samples)
+      .field("allocations", &Stats::allocations)
+      .field("peakBufferSize", &Stats::peakBufferSize)
+      .field("peakCodestreamMemory", &Stats::peakCodestreamMemory);
+}
+
 EMSCRIPTEN_BINDINGS(HTJ2KDecoder)
 {
   class_<HTJ2KDecoder>("HTJ2KDecoder")
       .constructor<>()
       .function("getEncodedBuffer", &HTJ2KDecoder::getEncodedBuffer)
       .function("getDecodedBuffer", &HTJ2KDecoder::getDecodedBuffer)
+      .function("allocateSlots", &HTJ2KDecoder::allocateSlots)
+      .function("getNumSlots", &HTJ2KDecoder::getNumSlots)
+      .function("selectSlot", &HTJ2KDecoder::selectSlot)
+      .function("getSlotEncodedBuffer", &HTJ2KDecoder::getSlotEncodedBuffer)
+      .function("getSlotDecodedBuffer", &HTJ2KDecoder::getSlotDecodedBuffer)
+      .function("setNumThreads", &HTJ2KDecoder::setNumThreads)
+      .function("getNumThreads", &HTJ2KDecoder::getNumThreads)
+      .function("setMaxQualityLayers", &HTJ2KDecoder::setMaxQualityLayers)
+      .function("getMaxQualityLayers", &HTJ2KDecoder::getMaxQualityLayers)
+      .function("setOutputFormat", &HTJ2KDecoder::setOutputFormat)
+      .function("getOutputFormat", &HTJ2KDecoder::getOutputFormat)
+      .function("setOutputLayout", &HTJ2KDecoder::setOutputLayout)
+      .function("getOutputLayout", &HTJ2KDecoder::getOutputLayout)
+      .function("getPaletteBuffer", &HTJ2KDecoder::getPaletteBuffer)
+      .function("resetPalette", &HTJ2KDecoder::resetPalette)
       .function("readHeader", &HTJ2KDecoder::readHeader)
       .function("calculateSizeAtDecompositionLevel", &HTJ2KDecoder::calculateSizeAtDecompositionLevel)
       .function("decode", &HTJ2KDecoder::decode)
       .function("decodeSubResolution", &HTJ2KDecoder::decodeSubResolution)
+      .function("decodeRegion", &HTJ2KDecoder::decodeRegion)
+      .function("decodeTiles", &HTJ2KDecoder::decodeTiles)
+      .function("decodeTile", &HTJ2KDecoder::decodeTile)
+      .function("decodeStripes", &HTJ2KDecoder::decodeStripes)
+      .function("decodeVOI", &HTJ2KDecoder::decodeVOI)
+      .function("beginIncrementalDecode", &HTJ2KDecoder::beginIncrementalDecode)
+      .function("appendEncodedBuffer", &HTJ2KDecoder::appendEncodedBuffer)
+      .function("decodeIncremental", &HTJ2KDecoder::decodeIncremental)
+      .function("getByteRanges", &HTJ2KDecoder::getByteRanges)
+      .function("getMissingByteRanges", &HTJ2KDecoder::getMissingByteRanges)
+      .function("beginSparseDecode", &HTJ2KDecoder::beginSparseDecode)
+      .function("getSparseEncodedBuffer", &HTJ2KDecoder::getSparseEncodedBuffer)
       .function("getFrameInfo", &HTJ2KDecoder::getFrameInfo)
       .function("getDownSample", &HTJ2KDecoder::getDownSample)
+      .function("getComponentSize", &HTJ2KDecoder::getComponentSize)
       .function("getNumDecompositions", &HTJ2KDecoder::getNumDecompositions)
       .function("getIsReversible", &HTJ2KDecoder::getIsReversible)
       .function("getProgressionOrder", &HTJ2KDecoder::getProgressionOrder)
       .function("getBlockDimensions", &HTJ2KDecoder::getBlockDimensions)
       .function("getIsUsingColorTransform", &HTJ2KDecoder::getIsUsingColorTransform)
-      .function("getIsHTEnabled", &HTJ2KDecoder::getIsHTEnabled);
+      .function("getIsHTEnabled", &HTJ2KDecoder::getIsHTEnabled)
+      .function("getNumLayers", &HTJ2KDecoder::getNumLayers)
+      .function("getTileSize", &HTJ2KDecoder::getTileSize)
+      .function("getNumTiles", &HTJ2KDecoder::getNumTiles)
+      .function("getPrecinctSize", &HTJ2KDecoder::getPrecinctSize)
+      .function("getHasPLT", &HTJ2KDecoder::getHasPLT)
+      .function("getHasTLM", &HTJ2KDecoder::getHasTLM)
+      .function("setStatsEnabled", &HTJ2KDecoder::setStatsEnabled)
+      .function("setTraceEnabled", &HTJ2KDecoder::setTraceEnabled)
+      .function("getStats", &HTJ2KDecoder::getStats)
+      .function("getTraceJson", &HTJ2KDecoder::getTraceJson)
+      .function("clearTrace", &HTJ2KDecoder::clearTrace);
 }
 
 EMSCRIPTEN_BINDINGS(HTJ2KEncoder)
 {
+  register_vector<float>("VectorFloat");
+
   class_<HTJ2KEncoder>("HTJ2KEncoder")
       .constructor<>()
       .function("getDecodedBuffer", &HTJ2KEncoder::getDecodedBuffer)
       .function("getEncodedBuffer", &HTJ2KEncoder::getEncodedBuffer)
+      .function("setEncodedBuffer", &HTJ2KEncoder::setEncodedBuffer)
       .function("encode", &HTJ2KEncoder::encode)
+      .function("beginEncode", &HTJ2KEncoder::beginEncode)
+      .function("getStripeBuffer", &HTJ2KEncoder::getStripeBuffer)
+      .function("encodeStripe", &HTJ2KEncoder::encodeStripe)
+      .function("finishEncode", &HTJ2KEncoder::finishEncode)
+      .function("getBatchDecodedBuffer", &HTJ2KEncoder::getBatchDecodedBuffer)
+      .function("getBatchEncodedBuffer", &HTJ2KEncoder::getBatchEncodedBuffer)
+      .function("getBatchSize", &HTJ2KEncoder::getBatchSize)
+      .function("encodeBatch", &HTJ2KEncoder::encodeBatch)
       .function("setDecompositions", &HTJ2KEncoder::setDecompositions)
       .function("setQuality", &HTJ2KEncoder::setQuality)
       .function("setProgressionOrder", &HTJ2KEncoder::setProgressionOrder)
       .function("setBlockDimensions", &HTJ2KEncoder::setBlockDimensions)
-      .function("setHTEnabled", &HTJ2KEncoder::setHTEnabled);
-}
\ No newline at end of file
+      .function("setHTEnabled", &HTJ2KEncoder::setHTEnabled)
+      .function("setNumThreads", &HTJ2KEncoder::setNumThreads)
+      .function("getNumThreads", &HTJ2KEncoder::getNumThreads)
+      .function("setTileSize", &HTJ2KEncoder::setTileSize)
+      .function("setPrecinctSize", &HTJ2KEncoder::setPrecinctSize)
+      .function("setPLTEnabled", &HTJ2KEncoder::setPLTEnabled)
+      .function("setTLMEnabled", &HTJ2KEncoder::setTLMEnabled)
+      .function("setQualityLayers", &HTJ2KEncoder::setQualityLayers)
+      .function("setTargetSize", &HTJ2KEncoder::setTargetSize)
+      .function("setTargetBitsPerPixel", &HTJ2KEncoder::setTargetBitsPerPixel)
+      .function("setLayerBitsPerPixel", &HTJ2KEncoder::setLayerBitsPerPixel)
+      .function("setJP2Enabled", &HTJ2KEncoder::setJP2Enabled)
+      .function("getEncodedSize", &HTJ2KEncoder::getEncodedSize)
+      .function("setStatsEnabled", &HTJ2KEncoder::setStatsEnabled)
+      .function("setTraceEnabled", &HTJ2KEncoder::setTraceEnabled)
+      .function("getStats", &HTJ2KEncoder::getStats)
+      .function("getTraceJson", &HTJ2KEncoder::getTraceJson)
+      .function("clearTrace", &HTJ2KEncoder::clearTrace);
+}
+
+EMSCRIPTEN_BINDINGS(HTJ2KTranscoder)
+{
+  class_<HTJ2KTranscoder>("HTJ2KTranscoder")
+      .constructor<>()
+      .function("getSourceBuffer", &HTJ2KTranscoder::getSourceBuffer)
+      .function("getTranscodedBuffer", &HTJ2KTranscoder::getTranscodedBuffer)
+      .function("transcode", &HTJ2KTranscoder::transcode);
+}
@@ -0,0 +1,55 @@
+// Copyright (c) Chris Hafey.
+// SPDX-License-Identifier: MIT
+
+// Loads kakadujs (WASM SIMD128) if the runtime supports WASM SIMD and the
+// scalar kakadujs-scalar otherwise.  Both modules have the same API.
+//
+// node:    const kakadujs = require('./kakadujs-loader.js')
+//          kakadujs.onRuntimeInitialized = () => { ... }
+//
+// browser: <script src="kakadujs-loader.js"></script>
+//          loadKakadujs('/path/to/dist/').then(kakadujs => { ... })
+(function () {
+  // the smallest module using a v128 instruction (i8x16.popcnt), it only
+  // validates if WASM SIMD is supported
+  const simdModule = new Uint8Array([0, 97, 115, 109, 1, 0, 0, 0, 1, 5, 1, 96, 0, 1, 123, 3, 2, 1, 0, 10, 10, 1, 8, 0, 65, 0, 253, 15, 253, 98, 11])
+
+  function hasSimd() {
+    try {
+      return WebAssembly.validate(simdModule)
+    } catch (e) {
+      return false
+    }
+  }
+
+  // returns the name of the module to load
+  function moduleName() {
+    return hasSimd() ? 'kakadujs' : 'kakadujs-scalar'
+  }
+
+  if (typeof module !== 'undefined' && module.exports) {
+    module.exports = require('./' + moduleName() + '.js')
+    return
+  }
+
+  // loads the module from baseUrl as a script and resolves with it once the
+  // runtime has initialized
+  self.loadKakadujs = function (baseUrl) {
+    baseUrl = baseUrl || ''
+    const name = moduleName()
+    return new Promise((resolve, reject) => {
+      const Module = self.Module = {
+        locateFile: (path) => baseUrl + path,
+        onRuntimeInitialized: () => resolve(Module)
+      }
+      if (typeof document !== 'undefined') {
+        const script = document.createElement('script')
+        script.src = baseUrl + name + '.js'
+        script.onerror = reject
+        document.head.appendChild(script)
+      } else {
+        importScripts(baseUrl + name + '.js') // web worker
+      }
+    })
+  }
+})()
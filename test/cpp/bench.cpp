@@ -0,0 +1,326 @@
+// Copyright (c) Chris Hafey.
+// SPDX-License-Identifier: MIT
+
+// Benchmarks every fixture in test/fixtures/j2c, j2k and raw and writes the
+// results as JSON (see test/node/bench.js for the equivalent WASM runner which
+// writes the same format so the two can be compared).
+//
+// usage: cppbench [iterations] [output.json] [numThreads]
+//
+// must be run from the root of the repository
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <HTJ2KDecoder.hpp>
+#include <HTJ2KEncoder.hpp>
+#include <HTJ2KTranscoder.hpp>
+
+class kdu_stream_message : public kdu_core::kdu_thread_safe_message
+{
+public: // Member classes
+    kdu_stream_message(std::ostream *stream)
+    {
+        this->stream = stream;
+    }
+    void put_text(const char *string)
+    {
+        (*stream) << string;
+    }
+    void flush(bool end_of_message = false)
+    {
+        stream->flush();
+        kdu_thread_safe_message::flush(end_of_message);
+    }
+
+private: // Data
+    std::ostream *stream;
+};
+
+static kdu_stream_message cerr_message(&std::cerr);
+static kdu_core::kdu_message_formatter pretty_cerr(&cerr_message);
+
+// The geometry of the raw fixtures which is not recorded in the files
+struct RawFixture
+{
+    const char *name;
+    FrameInfo frameInfo;
+};
+
+static const RawFixture rawFixtures[] = {
+    {"CT1.RAW", {512, 512, 16, 1, true}},
+    {"CT2.RAW", {512, 512, 16, 1, true}},
+    {"MR1.RAW", {512, 512, 16, 1, true}},
+    {"MR2.RAW", {1024, 1024, 16, 1, false}},
+    {"MR3.RAW", {512, 512, 16, 1, true}},
+    {"MR4.RAW", {512, 512, 16, 1, false}},
+    {"NM1.RAW", {256, 1024, 16, 1, true}},
+    {"US1.RAW", {640, 480, 8, 3, false}},
+    {"VL1.RAW", {756, 486, 8, 3, false}},
+    {"VL2.RAW", {756, 486, 8, 3, false}},
+    {"VL3.RAW", {756, 486, 8, 3, false}},
+    {"VL6.RAW", {756, 486, 8, 3, false}},
+    {"XA1.RAW", {1024, 1024, 16, 1, false}},
+};
+
+struct Percentiles
+{
+    double median;
+    double p95;
+};
+
+struct Result
+{
+    std::string fixture;
+    std::string operation;
+    size_t width;
+    size_t height;
+    Percentiles wall;
+    Percentiles cpu;
+    bool ok;
+};
+
+void readFile(const std::string &fileName, std::vector<uint8_t> &vec)
+{
+    std::ifstream file(fileName, std::ios::in | std::ios::binary | std::ios::ate);
+    if (file.fail())
+    {
+        throw "unable to open fixture";
+    }
+    vec.resize((size_t)file.tellg());
+    file.seekg(0, std::ios::beg);
+    file.read((char *)vec.data(), vec.size());
+}
+
+// returns the CPU time used by all threads of the process in ms.  std::clock()
+// cannot be used as it is wall clock time on Windows
+double getProcessCpuMs()
+{
+#ifdef _WIN32
+    FILETIME creationTime, exitTime, kernelTime, userTime;
+    GetProcessTimes(GetCurrentProcess(), &creationTime, &exitTime, &kernelTime, &userTime);
+    ULARGE_INTEGER kernel, user;
+    kernel.LowPart = kernelTime.dwLowDateTime;
+    kernel.HighPart = kernelTime.dwHighDateTime;
+    user.LowPart = userTime.dwLowDateTime;
+    user.HighPart = userTime.dwHighDateTime;
+    return (kernel.QuadPart + user.QuadPart) / 10000.0; // 100 ns units
+#else
+    timespec time;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time);
+    return time.tv_sec * 1000.0 + time.tv_nsec / 1000000.0;
+#endif
+}
+
+// returns the median and 95th percentile of the samples in ms, there must be
+// at least one sample
+Percentiles getPercentiles(std::vector<double> samples)
+{
+    std::sort(samples.begin(), samples.end());
+    Percentiles percentiles;
+    percentiles.median = samples[samples.size() / 2];
+    percentiles.p95 = samples[std::min((size_t)(samples.size() * 0.95), samples.size() - 1)];
+    return percentiles;
+}
+
+// runs fn once to warm up then iterations times recording the wall clock and
+// process CPU time of each run.  fn returns false if its output is wrong
+template <typename Fn>
+Result measure(const std::string &fixture, const char *operation, size_t iterations, Fn fn)
+{
+    Result result;
+    result.fixture = fixture;
+    result.operation = operation;
+    result.ok = fn();
+    std::vector<double> wall, cpu;
+    for (size_t i = 0; i < iterations; i++)
+    {
+        const double cpuStart = getProcessCpuMs();
+        const std::chrono::steady_clock::time_point wallStart = std::chrono::steady_clock::now();
+        result.ok = fn() && result.ok;
+        wall.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - wallStart).count());
+        cpu.push_back(getProcessCpuMs() - cpuStart);
+    }
+    result.wall = getPercentiles(wall);
+    result.cpu = getPercentiles(cpu);
+    return result;
+}
+
+std::vector<std::string> listFixtures(const char *directory)
+{
+    std::vector<std::string> paths;
+    for (const auto &entry : std::filesystem::directory_iterator(directory))
+    {
+        if (entry.is_regular_file())
+        {
+            paths.push_back(entry.path().generic_string());
+        }
+    }
+    std::sort(paths.begin(), paths.end());
+    return paths;
+}
+
+void writeJson(const char *path, const std::vector<Result> &results, size_t iterations, size_t numThreads)
+{
+    FILE *file = fopen(path, "w");
+    if (!file)
+    {
+        throw "unable to open output file";
+    }
+    fprintf(file, "{\n  \"runtime\": \"native\",\n  \"iterations\": %zu,\n  \"threads\": %zu,\n  \"results\": [\n", iterations, numThreads);
+    for (size_t i = 0; i < results.size(); i++)
+    {
+        const Result &r = results[i];
+        fprintf(file, "    {\"fixture\": \"%s\", \"operation\": \"%s\", \"width\": %zu, \"height\": %zu, "
+                      "\"wallMs\": {\"median\": %.4f, \"p95\": %.4f}, \"cpuMs\": {\"median\": %.4f, \"p95\": %.4f}, \"ok\": %s}%s\n",
+                r.fixture.c_str(), r.operation.c_str(), r.width, r.height,
+                r.wall.median, r.wall.p95, r.cpu.median, r.cpu.p95, r.ok ? "true" : "false",
+                (i + 1 < results.size()) ? "," : "");
+    }
+    fprintf(file, "  ]\n}\n");
+    fclose(file);
+}
+
+int main(int argc, char **argv)
+{
+    kdu_customize_errors(&pretty_cerr);
+
+    const int iterationsArg = (argc > 1) ? atoi(argv[1]) : 20;
+    if (iterationsArg < 1)
+    {
+        printf("ERROR: iterations must be at least 1\n");
+        return 1;
+    }
+    const size_t iterations = (size_t)iterationsArg;
+    const char *outputPath = (argc > 2) ? argv[2] : "bench-native.json";
+    const size_t numThreads = (argc > 3) ? atoi(argv[3]) : 0;
+
+    std::vector<Result> results;
+    try
+    {
+        HTJ2KDecoder decoder;
+        HTJ2KEncoder encoder;
+        HTJ2KTranscoder transcoder;
+        decoder.setNumThreads(numThreads);
+        encoder.setNumThreads(numThreads);
+
+        // decode and sub-resolution decode of every encoded fixture, and
+        // transcoding it to HTJ2K against a full decode and HTJ2K encode
+        std::vector<std::string> encodedPaths = listFixtures("test/fixtures/j2c");
+        std::vector<std::string> j2kPaths = listFixtures("test/fixtures/j2k");
+        encodedPaths.insert(encodedPaths.end(), j2kPaths.begin(), j2kPaths.end());
+        for (size_t i = 0; i < encodedPaths.size(); i++)
+        {
+            readFile(encodedPaths[i], decoder.getEncodedBytes());
+            decoder.readHeader();
+            const FrameInfo frameInfo = decoder.getFrameInfo();
+
+            Result result = measure(encodedPaths[i], "decode", iterations, [&]()
+                                    { decoder.decode(); return true; });
+            result.width = frameInfo.width;
+            result.height = frameInfo.height;
+            results.push_back(result);
+
+            result = measure(encodedPaths[i], "decodeSubResolution", iterations, [&]()
+                             { decoder.decodeSubResolution(1); return true; });
+            result.width = decoder.getFrameInfo().width;
+            result.height = decoder.getFrameInfo().height;
+            results.push_back(result);
+
+            readFile(encodedPaths[i], transcoder.getSourceBytes());
+            result = measure(encodedPaths[i], "transcode", iterations, [&]()
+                             { transcoder.transcode(); return true; });
+            result.width = frameInfo.width;
+            result.height = frameInfo.height;
+            results.push_back(result);
+
+            result = measure(encodedPaths[i], "decodeEncode", iterations, [&]()
+                             {
+                                 decoder.decode();
+                                 encoder.getDecodedBytes(decoder.getFrameInfo()) = decoder.getDecodedBytes();
+                                 encoder.encode();
+                                 return true; });
+            result.width = frameInfo.width;
+            result.height = frameInfo.height;
+            results.push_back(result);
+        }
+
+        // encode and lossless round trip of every raw fixture
+        std::vector<std::string> rawPaths = listFixtures("test/fixtures/raw");
+        for (size_t i = 0; i < rawPaths.size(); i++)
+        {
+            const std::string name = std::filesystem::path(rawPaths[i]).filename().string();
+            const RawFixture *pFixture = NULL;
+            for (size_t f = 0; f < sizeof(rawFixtures) / sizeof(rawFixtures[0]); f++)
+            {
+                if (name == rawFixtures[f].name)
+                {
+                    pFixture = &rawFixtures[f];
+                }
+            }
+            if (!pFixture)
+            {
+                printf("ERROR: no geometry for raw fixture %s, add it to rawFixtures\n", rawPaths[i].c_str());
+                return 1;
+            }
+            const FrameInfo &frameInfo = pFixture->frameInfo;
+            std::vector<uint8_t> &rawBytes = encoder.getDecodedBytes(frameInfo);
+            readFile(rawPaths[i], rawBytes);
+
+            Result result = measure(rawPaths[i], "encode", iterations, [&]()
+                                    { encoder.encode(); return true; });
+            result.width = frameInfo.width;
+            result.height = frameInfo.height;
+            results.push_back(result);
+
+            result = measure(rawPaths[i], "roundTrip", iterations, [&]()
+                             {
+                                 encoder.encode();
+                                 decoder.getEncodedBytes() = encoder.getEncodedBytes();
+                                 decoder.decode();
+                                 return decoder.getDecodedBytes() == rawBytes; });
+            result.width = frameInfo.width;
+            result.height = frameInfo.height;
+            results.push_back(result);
+        }
+    }
+    catch (const char *pError)
+    {
+        printf("ERROR: %s\n", pError);
+        return 1;
+    }
+
+    bool ok = true;
+    printf("%-32s %-20s %12s %12s %12s %12s\n", "fixture", "operation", "wall median", "wall p95", "cpu median", "cpu p95");
+    for (size_t i = 0; i < results.size(); i++)
+    {
+        const Result &r = results[i];
+        printf("%-32s %-20s %9.3f ms %9.3f ms %9.3f ms %9.3f ms%s\n", r.fixture.c_str(), r.operation.c_str(),
+               r.wall.median, r.wall.p95, r.cpu.median, r.cpu.p95, r.ok ? "" : " MISMATCH");
+        ok = ok && r.ok;
+    }
+    for (size_t i = 0; i + 1 < results.size(); i++)
+    {
+        if (results[i].operation == "transcode" && results[i + 1].operation == "decodeEncode")
+        {
+            printf("%-32s transcode is %.1fx faster than decode + encode\n", results[i].fixture.c_str(),
+                   results[i + 1].wall.median / std::max(results[i].wall.median, 0.001));
+        }
+    }
+    writeJson(outputPath, results, iterations, numThreads);
+    printf("results written to %s\n", outputPath);
+    return ok ? 0 : 1;
+}
@@ -7,8 +7,10 @@
 #include <iterator>
 #include <time.h>
 #include <algorithm>
+#include <thread>
 #include <HTJ2KDecoder.hpp>
 #include <HTJ2KEncoder.hpp>
+#include <HTJ2KTranscoder.hpp>
 
 /* ========================================================================= */
 /*                         Set up messaging services                         */
@@ -42,6 +44,7 @@ static kdu_core::kdu_message_formatter pretty_cerr(&cerr_message);
 
 #ifdef _WIN32
 #define CLOCK_PROCESS_CPUTIME_ID 0
+#define CLOCK_MONOTONIC 0
 // struct timespec { long tv_sec; long tv_nsec; };    //header part
 int clock_gettime(int, struct timespec *spec) // C-file part
 {
@@ -63,23 +66,15 @@ void readFile(std::string fileName, std::vector<uint8_t> &vec)
         printf("File %s does not exist\n", fileName.c_str());
         exit(1);
     }
-    // Stop eating new lines in binary mode!!!
-    file.unsetf(std::ios::skipws);
 
     // get its size:
-    int fileSize;
     file.seekg(0, std::ios::end);
-    fileSize = file.tellg();
+    const size_t fileSize = file.tellg();
     file.seekg(0, std::ios::beg);
 
-    // reserve capacity
-    vec.resize(0);
-    vec.reserve(fileSize);
-
-    // read the data:
-    vec.insert(vec.begin(),
-               std::istream_iterator<uint8_t>(file),
-               std::istream_iterator<uint8_t>());
+    // read the data in one go
+    vec.resize(fileSize);
+    file.read((char *)vec.data(), fileSize);
 }
 
 void writeFile(std::string fileName, const std::vector<uint8_t> &vec)
@@ -109,14 +104,16 @@ void sub_timespec(struct timespec t1, struct timespec t2, struct timespec *td)
     }
 }
 
-std::vector<uint8_t> decodeFile(const char *path, size_t iterations = 1, bool silent = false)
+std::vector<uint8_t> decodeFile(const char *path, size_t iterations = 1, bool silent = false, size_t numThreads = 0)
 {
     HTJ2KDecoder decoder;
+    decoder.setNumThreads(numThreads);
     std::vector<uint8_t> &encodedBytes = decoder.getEncodedBytes();
     readFile(path, encodedBytes);
 
+    // wall clock time since CPU time is summed across all decode threads
     timespec start, finish, delta;
-    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &start);
+    clock_gettime(CLOCK_MONOTONIC, &start);
     decoder.readHeader();
 
     for (int i = 0; i < iterations; i++)
@@ -124,7 +121,7 @@ std::vector<uint8_t> decodeFile(const char *path, size_t iterations = 1, bool si
         decoder.decode();
     }
 
-    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &finish);
+    clock_gettime(CLOCK_MONOTONIC, &finish);
     sub_timespec(start, finish, &delta);
     auto frameInfo = decoder.getFrameInfo();
 
@@ -138,17 +135,18 @@ std::vector<uint8_t> decodeFile(const char *path, size_t iterations = 1, bool si
 
     if (!silent)
     {
-        printf("NATIVE decode %s TotalTime: %.3f s for %zu iterations; TPF=%.3f ms (%.2f MP/s, %.2f FPS)\n", path, totalTimeMS / 1000, iterations, timePerFrameMS, mps, fps);
+        printf("NATIVE decode %s Threads: %zu TotalTime: %.3f s for %zu iterations; TPF=%.3f ms (%.2f MP/s, %.2f FPS)\n", path, std::max(numThreads, (size_t)1), totalTimeMS / 1000, iterations, timePerFrameMS, mps, fps);
     }
 
     // printf("Native-decode %s TotalTime= %.2f ms TPF=%.2f ms (%.2f MP/s, %.2f FPS)\n", path, totalTimeMS, timePerFrameMS, mps, fps);
     return decoder.getDecodedBytes();
 }
 
-void encodeFile(const char *inPath, const FrameInfo frameInfo, const char *outPath = NULL, size_t iterations = 1, bool silent = false)
+std::vector<uint8_t> encodeFile(const char *inPath, const FrameInfo frameInfo, const char *outPath = NULL, size_t iterations = 1, bool silent = false, size_t numThreads = 0)
 {
     // printf("FrameInfo %dx%dx%d %d bpp\n", frameInfo.width, frameInfo.height, frameInfo.componentCount, frameInfo.bitsPerSample);
     HTJ2KEncoder encoder;
+    encoder.setNumThreads(numThreads);
     encoder.setQuality(true, 0.0f);
     encoder.setDecompositions(5);
     encoder.setBlockDimensions(Size(64, 64));
@@ -157,15 +155,16 @@ void encodeFile(const char *inPath, const FrameInfo frameInfo, const char *outPa
 
     readFile(inPath, rawBytes);
 
+    // wall clock time since CPU time is summed across all encode threads
     timespec start, finish, delta;
-    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &start);
+    clock_gettime(CLOCK_MONOTONIC, &start);
 
     for (int i = 0; i < iterations; i++)
     {
         encoder.encode();
     }
 
-    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &finish);
+    clock_gettime(CLOCK_MONOTONIC, &finish);
     sub_timespec(start, finish, &delta);
 
     auto ns = delta.tv_sec * 1000000000.0 + delta.tv_nsec;
@@ -179,13 +178,913 @@ void encodeFile(const char *inPath, const FrameInfo frameInfo, const char *outPa
     const std::vector<uint8_t> &encodedBytes = encoder.getEncodedBytes();
     if (!silent)
     {
-        printf("NATIVE encode %s TotalTime: %.3f s for %zu iterations; TPF=%.3f ms (%.2f MP/s, %.2f FPS)\n", inPath, totalTimeMS / 1000, iterations, timePerFrameMS, mps, fps);
+        printf("NATIVE encode %s Threads: %zu TotalTime: %.3f s for %zu iterations; TPF=%.3f ms (%.2f MP/s, %.2f FPS)\n", inPath, std::max(numThreads, (size_t)1), totalTimeMS / 1000, iterations, timePerFrameMS, mps, fps);
     }
 
     if (outPath)
     {
         writeFile(outPath, encodedBytes);
     }
+    return encodedBytes;
+}
+
+// probes the header of US1.j2k (640x480 RGB, 5 levels, reversible with the
+// colour transform, 1 layer, no tiles or precincts) and verifies decode()
+// reuses the codestream parsed by readHeader().  The SIZ width is overwritten
+// after readHeader() so re-parsing the header would change the decoded width
+bool decodeFileHeader(const char *path)
+{
+    std::vector<uint8_t> encoded;
+    readFile(path, encoded);
+    HTJ2KDecoder decoder;
+    decoder.setEncodedBytes(&encoded);
+    decoder.readHeader();
+    const FrameInfo frameInfo = decoder.getFrameInfo();
+    bool matches = frameInfo.width == 640 && frameInfo.height == 480 && frameInfo.componentCount == 3 &&
+                   frameInfo.bitsPerSample == 8 && !frameInfo.isSigned &&
+                   decoder.getNumDecompositions() == 5 && decoder.getIsReversible() &&
+                   decoder.getProgressionOrder() == 0 && decoder.getIsUsingColorTransform() &&
+                   !decoder.getIsHTEnabled() && decoder.getNumLayers() == 1 &&
+                   decoder.getBlockDimensions().width == 64 && decoder.getBlockDimensions().height == 64 &&
+                   decoder.getNumTiles().width == 1 && decoder.getNumTiles().height == 1 &&
+                   decoder.getTileSize().width == 640 && decoder.getTileSize().height == 480 &&
+                   !decoder.getHasPLT() && !decoder.getHasTLM();
+    for (size_t c = 0; c < frameInfo.componentCount; c++)
+    {
+        matches = matches && decoder.getDownSample(c).x == 1 && decoder.getDownSample(c).y == 1;
+    }
+    for (size_t level = 0; level <= decoder.getNumDecompositions(); level++)
+    {
+        matches = matches && decoder.getPrecinctSize(level).width == 32768 && decoder.getPrecinctSize(level).height == 32768;
+    }
+    try
+    {
+        decoder.getPrecinctSize(decoder.getNumDecompositions() + 1);
+        matches = false;
+    }
+    catch (const char *)
+    {
+    }
+
+    const uint8_t soc[4] = {0xFF, 0x4F, 0xFF, 0x51};
+    const size_t offset = std::search(encoded.begin(), encoded.end(), soc, soc + 4) - encoded.begin();
+    encoded[offset + 10] = 0; // Xsiz 640 (0x280) -> 128
+    decoder.decode();
+    matches = matches && decoder.getFrameInfo().width == 640 && decoder.getDecodedBytes().size() == 640 * 480 * 3;
+    if (!matches)
+    {
+        printf("ERROR: header probe of %s does not match\n", path);
+    }
+    return matches;
+}
+
+// decodes path at every decomposition level, verifying the reported size and
+// decoded buffer size match the reduced resolution
+bool decodeFileSubResolutions(const char *path)
+{
+    HTJ2KDecoder decoder;
+    readFile(path, decoder.getEncodedBytes());
+    decoder.readHeader();
+    for (size_t level = 0; level <= decoder.getNumDecompositions(); level++)
+    {
+        decoder.decodeSubResolution(level);
+        const FrameInfo &frameInfo = decoder.getFrameInfo();
+        const Size expected = decoder.calculateSizeAtDecompositionLevel(level);
+        const size_t bytesPerSample = (frameInfo.bitsPerSample + 7) / 8;
+        if (frameInfo.width != expected.width || frameInfo.height != expected.height ||
+            decoder.getDecodedBytes().size() != expected.width * expected.height * frameInfo.componentCount * bytesPerSample)
+        {
+            printf("ERROR: decodeSubResolution(%zu) of %s returned %dx%d (%zu bytes), expected %dx%d\n", level, path,
+                   frameInfo.width, frameInfo.height, decoder.getDecodedBytes().size(), expected.width, expected.height);
+            return false;
+        }
+    }
+    return true;
+}
+
+// decodes a region of path, verifying it matches the same region of the full decode
+bool decodeFileRegion(const char *path, size_t x, size_t y, size_t width, size_t height)
+{
+    HTJ2KDecoder decoder;
+    readFile(path, decoder.getEncodedBytes());
+    decoder.decode();
+    const std::vector<uint8_t> full = decoder.getDecodedBytes();
+    const FrameInfo fullFrameInfo = decoder.getFrameInfo();
+    const size_t bytesPerPixel = ((fullFrameInfo.bitsPerSample + 7) / 8) * fullFrameInfo.componentCount;
+
+    decoder.decodeRegion(x, y, width, height, 0);
+    const FrameInfo &frameInfo = decoder.getFrameInfo();
+    const std::vector<uint8_t> &region = decoder.getDecodedBytes();
+    bool matches = frameInfo.width == width && frameInfo.height == height;
+    for (size_t row = 0; matches && row < height; row++)
+    {
+        matches = std::equal(region.begin() + row * width * bytesPerPixel,
+                             region.begin() + (row + 1) * width * bytesPerPixel,
+                             full.begin() + ((y + row) * fullFrameInfo.width + x) * bytesPerPixel);
+    }
+    if (!matches)
+    {
+        printf("ERROR: decodeRegion(%zu, %zu, %zu, %zu) of %s does not match the full decode\n", x, y, width, height, path);
+    }
+    return matches;
+}
+
+// decodes path in stripes, verifying the stripes match the full decode
+bool decodeFileStripes(const char *path, size_t stripeHeight)
+{
+    HTJ2KDecoder decoder;
+    readFile(path, decoder.getEncodedBytes());
+    decoder.decode();
+    const std::vector<uint8_t> full = decoder.getDecodedBytes();
+
+    std::vector<uint8_t> stripes;
+    size_t nextRow = 0;
+    decoder.decodeStripes(0, stripeHeight, [&](const uint8_t *pStripe, size_t stripeSize, size_t firstRow, size_t numRows)
+                          {
+                              nextRow = (firstRow == nextRow) ? firstRow + numRows : SIZE_MAX;
+                              stripes.insert(stripes.end(), pStripe, pStripe + stripeSize); });
+    const bool matches = nextRow == decoder.getFrameInfo().height && stripes == full;
+    if (!matches)
+    {
+        printf("ERROR: decodeStripes(0, %zu) of %s does not match the full decode\n", stripeHeight, path);
+    }
+    return matches;
+}
+
+// decodes path incrementally as chunks are appended, verifying the result
+// once all chunks have arrived matches the full decode
+bool decodeFileIncremental(const char *path, size_t chunkSize)
+{
+    HTJ2KDecoder decoder;
+    std::vector<uint8_t> encoded;
+    readFile(path, encoded);
+    decoder.setEncodedBytes(&encoded);
+    decoder.decode();
+    const std::vector<uint8_t> full = decoder.getDecodedBytes();
+    decoder.setEncodedBytes(0);
+
+    decoder.beginIncrementalDecode(encoded.size());
+    size_t numDecodes = 0;
+    for (size_t offset = 0; offset < encoded.size(); offset += chunkSize)
+    {
+        decoder.appendEncodedBytes(encoded.data() + offset, std::min(chunkSize, encoded.size() - offset));
+        numDecodes += decoder.decodeIncremental(0) ? 1 : 0;
+    }
+    const bool matches = numDecodes > 1 && !decoder.decodeIncremental(0) && decoder.getDecodedBytes() == full;
+    if (!matches)
+    {
+        printf("ERROR: incremental decode of %s in %zu byte chunks does not match the full decode\n", path, chunkSize);
+    }
+    return matches;
+}
+
+// encodes the 16 bit single component rawBytes losslessly with the Part 1
+// block coder and numLayers quality layers.  No layer sizes or slopes are
+// given so Kakadu spaces the layers with the last one lossless
+void encodePart1(std::vector<uint8_t> &rawBytes, const FrameInfo &frameInfo, size_t numLayers, std::vector<uint8_t> &encoded)
+{
+    kdu_buffer_target target(encoded);
+    kdu_core::siz_params siz;
+    siz.set(Scomponents, 0, 0, 1);
+    siz.set(Sdims, 0, 0, frameInfo.height);
+    siz.set(Sdims, 0, 1, frameInfo.width);
+    siz.set(Sprecision, 0, 0, frameInfo.bitsPerSample);
+    siz.set(Ssigned, 0, 0, frameInfo.isSigned);
+    kdu_core::kdu_params *siz_ref = &siz;
+    siz_ref->finalize();
+    kdu_core::kdu_codestream codestream;
+    codestream.create(&siz, &target);
+    char param[32];
+    snprintf(param, 32, "Clayers=%zu", numLayers);
+    codestream.access_siz()->parse_string(param);
+    codestream.access_siz()->parse_string("Creversible=yes");
+    codestream.access_siz()->finalize_all();
+    kdu_supp::kdu_stripe_compressor compressor;
+    compressor.start(codestream, (int)numLayers);
+    int height = frameInfo.height;
+    int precision = frameInfo.bitsPerSample;
+    bool isSigned = frameInfo.isSigned;
+    compressor.push_stripe((kdu_core::kdu_int16 *)rawBytes.data(), &height, NULL, NULL, NULL, &precision, &isSigned);
+    compressor.finish();
+    codestream.destroy();
+    target.close();
+}
+
+// encodes the 16 bit single component inPath losslessly with the Part 1 block
+// coder and numLayers quality layers then decodes it with fewer layers,
+// verifying only the full set of layers reproduces the image and that a limit
+// above the number of layers decodes all of them
+bool decodeFileLayers(const char *inPath, const FrameInfo frameInfo, size_t numLayers)
+{
+    std::vector<uint8_t> rawBytes;
+    readFile(inPath, rawBytes);
+    std::vector<uint8_t> encoded;
+    encodePart1(rawBytes, frameInfo, numLayers, encoded);
+
+    HTJ2KDecoder decoder;
+    decoder.setEncodedBytes(&encoded);
+    decoder.setMaxQualityLayers(1);
+    decoder.decode();
+    bool matches = decoder.getMaxQualityLayers() == 1 && decoder.getNumLayers() == numLayers &&
+                   decoder.getDecodedBytes().size() == rawBytes.size() && decoder.getDecodedBytes() != rawBytes;
+    const size_t limits[3] = {numLayers, numLayers + 1, 0};
+    for (size_t i = 0; i < 3; i++)
+    {
+        decoder.setMaxQualityLayers(limits[i]);
+        decoder.decode();
+        matches = matches && decoder.getDecodedBytes() == rawBytes;
+    }
+    if (!matches)
+    {
+        printf("ERROR: layer limited decode of %zu layer encode of %s does not match\n", numLayers, inPath);
+    }
+    return matches;
+}
+
+// decodes each of paths into its own buffer slot twice, verifying the result
+// matches a regular decode and the second pass does not allocate
+bool decodeFilesSlots(const std::vector<const char *> &paths)
+{
+    HTJ2KDecoder decoder;
+    std::vector<std::vector<uint8_t>> expected;
+    for (size_t i = 0; i < paths.size(); i++)
+    {
+        expected.push_back(decodeFile(paths[i], 1, true));
+    }
+
+    decoder.allocateSlots(paths.size(), 1024 * 1024, 1024 * 1024);
+    decoder.setStatsEnabled(true);
+    bool matches = true;
+    for (size_t pass = 0; pass < 2; pass++)
+    {
+        for (size_t slot = 0; slot < paths.size(); slot++)
+        {
+            std::vector<uint8_t> encoded;
+            readFile(paths[slot], encoded);
+            std::copy(encoded.begin(), encoded.end(), decoder.getSlotEncodedBytes(slot, encoded.size()));
+            decoder.selectSlot(slot);
+            decoder.decode();
+            const uint8_t *pDecoded = decoder.getSlotDecodedBytes(slot);
+            matches = matches && decoder.getStats().allocations == 0 &&
+                      std::vector<uint8_t>(pDecoded, pDecoded + decoder.getSlotDecodedSize(slot)) == expected[slot];
+        }
+    }
+    if (!matches)
+    {
+        printf("ERROR: slot decode does not match or allocated\n");
+    }
+    return matches;
+}
+
+// decodes path with a linear VOI window, verifying the 8 bit result matches
+// the window applied to a regular decode of a signed 16 bit image
+bool decodeFileVOI(const char *path, double windowCenter, double windowWidth)
+{
+    const std::vector<uint8_t> decoded = decodeFile(path, 1, true);
+    const int16_t *samples = (const int16_t *)decoded.data();
+
+    HTJ2KDecoder decoder;
+    readFile(path, decoder.getEncodedBytes());
+    VOI voi = {windowCenter, windowWidth, 1.0, 0.0, VOI_LINEAR};
+    decoder.decodeVOI(0, voi);
+    const std::vector<uint8_t> &windowed = decoder.getDecodedBytes();
+
+    bool matches = windowed.size() == decoded.size() / 2 && decoder.getFrameInfo().bitsPerSample == 8;
+    for (size_t i = 0; matches && i < windowed.size(); i++)
+    {
+        const double y = ((samples[i] - (windowCenter - 0.5)) / (windowWidth - 1) + 0.5) * 255.0;
+        matches = windowed[i] == (uint8_t)std::min(std::max(y + 0.5, 0.0), 255.0);
+    }
+    if (!matches)
+    {
+        printf("ERROR: VOI decode of %s does not match\n", path);
+    }
+    return matches;
+}
+
+// decodes path to RGBA, verifying the color (or VOI windowed grayscale) samples
+// match the native (or VOI) decode and alpha is opaque
+bool decodeFileRGBA(const char *path, const VOI *pVOI)
+{
+    HTJ2KDecoder decoder;
+    readFile(path, decoder.getEncodedBytes());
+    if (pVOI)
+    {
+        decoder.decodeVOI(0, *pVOI);
+    }
+    else
+    {
+        decoder.decode();
+    }
+    const std::vector<uint8_t> expected = decoder.getDecodedBytes();
+    const size_t componentCount = decoder.getFrameInfo().componentCount;
+
+    decoder.setOutputFormat(OUTPUT_RGBA);
+    if (pVOI)
+    {
+        decoder.decodeVOI(0, *pVOI);
+    }
+    else
+    {
+        decoder.decode();
+    }
+    const std::vector<uint8_t> &rgba = decoder.getDecodedBytes();
+    bool matches = rgba.size() == expected.size() / componentCount * 4 && decoder.getFrameInfo().componentCount == 4;
+    for (size_t i = 0; matches && i < rgba.size() / 4; i++)
+    {
+        for (size_t c = 0; c < 3; c++)
+        {
+            matches = matches && rgba[i * 4 + c] == expected[i * componentCount + (componentCount == 3 ? c : 0)];
+        }
+        matches = matches && rgba[i * 4 + 3] == 255;
+    }
+    if (!matches)
+    {
+        printf("ERROR: RGBA decode of %s does not match\n", path);
+    }
+    return matches;
+}
+
+// decodes path to planar output, verifying each plane matches the component
+// in the interleaved decode
+bool decodeFilePlanar(const char *path)
+{
+    HTJ2KDecoder decoder;
+    readFile(path, decoder.getEncodedBytes());
+    decoder.decode();
+    const std::vector<uint8_t> interleaved = decoder.getDecodedBytes();
+    const size_t componentCount = decoder.getFrameInfo().componentCount;
+
+    decoder.setOutputLayout(LAYOUT_PLANAR);
+    decoder.decode();
+    const std::vector<uint8_t> &planar = decoder.getDecodedBytes();
+    const size_t planeSize = decoder.getComponentSize(0).width * decoder.getComponentSize(0).height;
+    bool matches = planar.size() == interleaved.size();
+    for (size_t i = 0; matches && i < planar.size(); i++)
+    {
+        matches = planar[i] == interleaved[(i % planeSize) * componentCount + i / planeSize];
+    }
+    if (!matches)
+    {
+        printf("ERROR: planar decode of %s does not match\n", path);
+    }
+    return matches;
+}
+
+// decodes path from caller owned memory and from a memory mapping of the
+// file, verifying both match the decode of the encoded buffer
+bool decodeFileMapped(const char *path)
+{
+    HTJ2KDecoder decoder;
+    std::vector<uint8_t> encoded;
+    readFile(path, encoded);
+    decoder.getEncodedBytes() = encoded;
+    decoder.decode();
+    const std::vector<uint8_t> expected = decoder.getDecodedBytes();
+
+    decoder.decode(encoded.data(), encoded.size());
+    bool matches = decoder.getDecodedBytes() == expected;
+    decoder.decodeFile(path);
+    matches = matches && decoder.getDecodedBytes() == expected;
+    if (!matches)
+    {
+        printf("ERROR: mapped decode of %s does not match\n", path);
+    }
+    return matches;
+}
+
+// transcodes source (named name) to HTJ2K, verifying the result uses the HT
+// block coder and decodes to exactly the same samples as the source.  The
+// result is transcoded again to check HT sources are carried over exactly too
+bool transcodeBytes(const char *name, const std::vector<uint8_t> &source)
+{
+    HTJ2KDecoder decoder;
+    decoder.getEncodedBytes() = source;
+    decoder.decode();
+    const std::vector<uint8_t> expected = decoder.getDecodedBytes();
+
+    HTJ2KTranscoder transcoder;
+    transcoder.getSourceBytes() = source;
+    bool matches = true;
+    for (size_t pass = 0; matches && pass < 2; pass++)
+    {
+        transcoder.transcode();
+        decoder.getEncodedBytes() = transcoder.getTranscodedBytes();
+        decoder.decode();
+        matches = decoder.getIsHTEnabled() && decoder.getDecodedBytes() == expected;
+        transcoder.getSourceBytes() = transcoder.getTranscodedBytes();
+    }
+    if (!matches)
+    {
+        printf("ERROR: transcode of %s does not match\n", name);
+    }
+    return matches;
+}
+
+bool transcodeFile(const char *path)
+{
+    std::vector<uint8_t> source;
+    readFile(path, source);
+    return transcodeBytes(path, source);
+}
+
+// re-codes the code-blocks of the Part 1 codestream source into truncated
+// with numLayers quality layers, dropping the last coded bit-plane of every
+// code-block that has more than one.  Only the cleanup passes are given a
+// slope, so every code-block and every layer ends on a cleanup pass
+void truncatePart1(std::vector<uint8_t> &source, size_t numLayers, std::vector<uint8_t> &truncated)
+{
+    kdu_core::kdu_compressed_source_buffered input(source.data(), source.size());
+    kdu_buffer_target target(truncated);
+    kdu_core::kdu_codestream in;
+    kdu_core::kdu_codestream out;
+    in.create(&input);
+    out.create(in.access_siz(), &target);
+    out.access_siz()->copy_all(in.access_siz());
+    out.access_siz()->access_cluster(COD_params)->set(Clayers, 0, 0, (int)numLayers);
+    out.access_siz()->finalize_all();
+
+    kdu_core::kdu_block_decoder decoder;
+    kdu_core::kdu_block_encoder encoder;
+    kdu_core::kdu_dims tiles;
+    in.get_valid_tiles(tiles);
+    for (int t = 0; t < (int)tiles.area(); t++)
+    {
+        const kdu_core::kdu_coords tileIndex = tiles.pos + kdu_core::kdu_coords(t % tiles.size.x, t / tiles.size.x);
+        kdu_core::kdu_tile tileIn = in.open_tile(tileIndex);
+        kdu_core::kdu_tile tileOut = out.open_tile(tileIndex);
+        for (int c = 0; c < tileIn.get_num_components(); c++)
+        {
+            kdu_core::kdu_tile_comp compIn = tileIn.access_component(c);
+            kdu_core::kdu_tile_comp compOut = tileOut.access_component(c);
+            for (int r = 0; r < compIn.get_num_resolutions(); r++)
+            {
+                kdu_core::kdu_resolution resIn = compIn.access_resolution(r);
+                kdu_core::kdu_resolution resOut = compOut.access_resolution(r);
+                int minBand;
+                const int numBands = resIn.get_valid_band_indices(minBand);
+                for (int b = minBand; b < minBand + numBands; b++)
+                {
+                    kdu_core::kdu_subband bandIn = resIn.access_subband(b);
+                    kdu_core::kdu_subband bandOut = resOut.access_subband(b);
+                    kdu_core::kdu_dims blocks;
+                    bandIn.get_valid_blocks(blocks);
+                    for (int i = 0; i < (int)blocks.area(); i++)
+                    {
+                        const kdu_core::kdu_coords blockIndex = blocks.pos + kdu_core::kdu_coords(i % blocks.size.x, i / blocks.size.x);
+                        kdu_core::kdu_block *blockIn = bandIn.open_block(blockIndex);
+                        kdu_core::kdu_block *blockOut = bandOut.open_block(blockIndex);
+                        blockOut->num_passes = 0;
+                        if (blockIn->num_passes > 0)
+                        {
+                            const int numSamples = ((blockIn->size.y + 3) & ~3) * blockIn->size.x;
+                            blockIn->set_max_samples(numSamples);
+                            decoder.decode(blockIn);
+                            blockOut->set_max_samples(numSamples);
+                            memcpy(blockOut->sample_buffer, blockIn->sample_buffer, numSamples * sizeof(kdu_core::kdu_int32));
+                            encoder.encode(blockOut, bandOut.get_reversible(), bandOut.get_msb_wmse(), 0);
+                            const int numCleanups = std::max((blockOut->num_passes + 2) / 3 - 1, 1);
+                            blockOut->num_passes = std::min(blockOut->num_passes, 3 * numCleanups - 2);
+                            for (int p = 0; p < blockOut->num_passes; p++)
+                            {
+                                blockOut->pass_slopes[p] = (p % 3 == 0) ? (kdu_core::kdu_uint16)(0xFFFF - 256 * (p / 3)) : 0;
+                            }
+                        }
+                        bandIn.close_block(blockIn);
+                        bandOut.close_block(blockOut);
+                    }
+                }
+            }
+        }
+        tileIn.close();
+        tileOut.close();
+    }
+
+    // every third cleanup pass starts a new layer, the last layer has the rest
+    std::vector<kdu_core::kdu_long> layerBytes(numLayers, 0);
+    std::vector<kdu_core::kdu_uint16> thresholds(numLayers, 1);
+    for (size_t layer = 0; layer + 1 < numLayers; layer++)
+    {
+        thresholds[layer] = (kdu_core::kdu_uint16)(0xFFFF - 256 * 3 * (layer + 1));
+    }
+    out.flush(layerBytes.data(), (int)numLayers, thresholds.data());
+    out.destroy();
+    in.destroy();
+    input.close();
+    target.close();
+}
+
+// transcodes a numLayers layer Part 1 codestream of inPath whose code-blocks
+// are truncated by a bit-plane, verifying it decodes to exactly the same
+// samples as the truncated source
+bool transcodeTruncated(const char *inPath, const FrameInfo frameInfo, size_t numLayers)
+{
+    std::vector<uint8_t> rawBytes;
+    readFile(inPath, rawBytes);
+    std::vector<uint8_t> encoded;
+    encodePart1(rawBytes, frameInfo, 1, encoded);
+    std::vector<uint8_t> truncated;
+    truncatePart1(encoded, numLayers, truncated);
+
+    HTJ2KDecoder decoder;
+    decoder.setEncodedBytes(&truncated);
+    decoder.decode();
+    if (decoder.getNumLayers() != numLayers || decoder.getDecodedBytes() == rawBytes)
+    {
+        printf("ERROR: %s is not a truncated %zu layer source\n", inPath, numLayers);
+        return false;
+    }
+    return transcodeBytes(inPath, truncated);
+}
+
+// encodes a 4:2:0 three component image with an odd sized luma plane (so
+// the chroma planes round up) and decodes it to planar output, verifying the
+// size, offset and samples of each plane and that interleaved output is refused
+bool decodeSubsampledPlanar(size_t width, size_t height)
+{
+    const int sampling[3] = {1, 2, 2};
+    std::vector<std::vector<uint8_t>> planes(3);
+    int heights[3];
+    kdu_core::kdu_byte *buffers[3];
+    for (size_t c = 0; c < 3; c++)
+    {
+        const size_t planeWidth = (width + sampling[c] - 1) / sampling[c];
+        const size_t planeHeight = (height + sampling[c] - 1) / sampling[c];
+        planes[c].resize(planeWidth * planeHeight);
+        for (size_t i = 0; i < planes[c].size(); i++)
+        {
+            planes[c][i] = (uint8_t)(i * 7 + c * 50);
+        }
+        heights[c] = (int)planeHeight;
+        buffers[c] = planes[c].data();
+    }
+
+    std::vector<uint8_t> encoded;
+    kdu_buffer_target target(encoded);
+    kdu_core::siz_params siz;
+    siz.set(Scomponents, 0, 0, 3);
+    siz.set(Sdims, 0, 0, (int)height);
+    siz.set(Sdims, 0, 1, (int)width);
+    siz.set(Sprecision, 0, 0, 8);
+    siz.set(Ssigned, 0, 0, false);
+    for (int c = 0; c < 3; c++)
+    {
+        siz.set(Ssampling, c, 0, sampling[c]);
+        siz.set(Ssampling, c, 1, sampling[c]);
+    }
+    kdu_core::kdu_params *siz_ref = &siz;
+    siz_ref->finalize();
+    kdu_core::kdu_codestream codestream;
+    codestream.create(&siz, &target);
+    codestream.access_siz()->parse_string("Cmodes=HT");
+    codestream.access_siz()->parse_string("Creversible=yes");
+    codestream.access_siz()->parse_string("Cycc=no");
+    codestream.access_siz()->parse_string("Clevels=2");
+    codestream.access_siz()->finalize_all();
+    kdu_supp::kdu_stripe_compressor compressor;
+    compressor.start(codestream);
+    compressor.push_stripe(buffers, heights);
+    compressor.finish();
+    codestream.destroy();
+    target.close();
+
+    HTJ2KDecoder decoder;
+    decoder.setEncodedBytes(&encoded);
+    decoder.setOutputLayout(LAYOUT_PLANAR);
+    decoder.decode();
+    const std::vector<uint8_t> &decoded = decoder.getDecodedBytes();
+    bool matches = decoder.getFrameInfo().componentCount == 3 &&
+                   decoder.getFrameInfo().width == width && decoder.getFrameInfo().height == height &&
+                   decoded.size() == planes[0].size() + planes[1].size() + planes[2].size();
+    size_t offset = 0;
+    for (size_t c = 0; matches && c < 3; c++)
+    {
+        const Size size = decoder.getComponentSize(c);
+        matches = decoder.getDownSample(c).x == (uint32_t)sampling[c] && decoder.getDownSample(c).y == (uint32_t)sampling[c] &&
+                  size.width == (width + sampling[c] - 1) / sampling[c] &&
+                  size.height == (height + sampling[c] - 1) / sampling[c] &&
+                  std::equal(planes[c].begin(), planes[c].end(), decoded.begin() + offset);
+        offset += planes[c].size();
+    }
+
+    bool refused = false;
+    try
+    {
+        decoder.setOutputLayout(LAYOUT_INTERLEAVED);
+        decoder.decode();
+    }
+    catch (const char *)
+    {
+        refused = true;
+    }
+    if (!matches || !refused)
+    {
+        printf("ERROR: planar decode of a %zux%zu 4:2:0 image does not match\n", width, height);
+    }
+    return matches && refused;
+}
+
+// decodes path with statistics and tracing enabled, verifying the stats of
+// the last call and the trace events are recorded
+bool decodeFileStats(const char *path)
+{
+    HTJ2KDecoder decoder;
+    readFile(path, decoder.getEncodedBytes());
+    decoder.setStatsEnabled(true);
+    decoder.setTraceEnabled(true);
+    decoder.decode();
+    const Stats stats = decoder.getStats();
+    const std::string trace = decoder.getTraceJson();
+    const bool matches = stats.totalMs > 0 && stats.totalMs >= stats.processMs && stats.bytes > 0 &&
+                         stats.peakBufferSize == decoder.getDecodedBytes().size() &&
+                         trace.find("\"decode.pull\"") != std::string::npos;
+    if (!matches)
+    {
+        printf("ERROR: decode statistics of %s were not recorded\n", path);
+    }
+    return matches;
+}
+
+// decodes path with an increasing number of threads, verifying each result
+// matches the single threaded decode and printing the scaling curve
+bool decodeFileThreadScaling(const char *path, size_t iterations)
+{
+    const size_t maxThreads = std::max(std::thread::hardware_concurrency(), 1u);
+    const std::vector<uint8_t> expected = decodeFile(path, iterations, false, 1);
+    bool matches = true;
+    for (size_t numThreads = 2; numThreads <= maxThreads; numThreads *= 2)
+    {
+        if (decodeFile(path, iterations, false, numThreads) != expected)
+        {
+            printf("ERROR: %zu thread decode of %s does not match single threaded decode\n", numThreads, path);
+            matches = false;
+        }
+    }
+    return matches;
+}
+
+// encodes inPath as a bare J2C codestream into a caller owned buffer and
+// verifies it decodes back to the original pixels and the internal encoded
+// buffer no longer holds the previous encode
+bool encodeFileRoundTrip(const char *inPath, const FrameInfo frameInfo)
+{
+    HTJ2KEncoder encoder;
+    std::vector<uint8_t> &rawBytes = encoder.getDecodedBytes(frameInfo);
+    readFile(inPath, rawBytes);
+    encoder.encode();
+    std::vector<uint8_t> encoded(rawBytes.size() * 2);
+    encoder.setEncodedBuffer(encoded.data(), encoded.size());
+    encoder.setJP2Enabled(false);
+    encoder.encode();
+    encoded.resize(encoder.getEncodedSize());
+
+    HTJ2KDecoder decoder;
+    decoder.setEncodedBytes(&encoded);
+    decoder.decode();
+    const bool matches = encoded[0] == 0xFF && encoded[1] == 0x4F && decoder.getDecodedBytes() == rawBytes &&
+                         encoder.getEncodedBytes().empty();
+    if (!matches)
+    {
+        printf("ERROR: J2C round trip of %s does not match the original\n", inPath);
+    }
+    return matches;
+}
+
+// streams a generated componentCount component 12 bit image to the encoder
+// in stripes of stripeHeight rows and verifies it decodes back losslessly
+bool encodeComponents(size_t componentCount, size_t stripeHeight)
+{
+    const FrameInfo frameInfo = {.width = 61, .height = 47, .bitsPerSample = 12, .componentCount = (uint8_t)componentCount, .isSigned = false};
+    std::vector<uint16_t> samples((size_t)frameInfo.width * frameInfo.height * componentCount);
+    for (size_t i = 0; i < samples.size(); i++)
+    {
+        samples[i] = (uint16_t)((i * 37 + i / componentCount) & 0xFFF);
+    }
+    HTJ2KEncoder encoder;
+    encoder.setJP2Enabled(false);
+    encoder.beginEncode(frameInfo);
+    const size_t rowSize = (size_t)frameInfo.width * componentCount;
+    for (size_t row = 0; row < frameInfo.height; row += stripeHeight)
+    {
+        encoder.encodeStripe((const uint8_t *)(samples.data() + row * rowSize), std::min(stripeHeight, (size_t)frameInfo.height - row));
+    }
+    encoder.finishEncode();
+    std::vector<uint8_t> encoded = encoder.getEncodedBytes();
+
+    HTJ2KDecoder decoder;
+    decoder.setEncodedBytes(&encoded);
+    decoder.decode();
+    const std::vector<uint8_t> &decoded = decoder.getDecodedBytes();
+    const bool matches = decoder.getFrameInfo().componentCount == componentCount && decoded.size() == samples.size() * 2 &&
+                         memcmp(decoded.data(), samples.data(), decoded.size()) == 0;
+    if (!matches)
+    {
+        printf("ERROR: %zu component stripe encode does not round trip\n", componentCount);
+    }
+    return matches;
+}
+
+// encodes inPath by pushing stripes of rows, verifying the result is byte
+// identical to encoding the whole frame in one call
+bool encodeFileStripes(const char *inPath, const FrameInfo frameInfo, size_t stripeHeight)
+{
+    HTJ2KEncoder encoder;
+    std::vector<uint8_t> &rawBytes = encoder.getDecodedBytes(frameInfo);
+    readFile(inPath, rawBytes);
+    encoder.encode();
+    const std::vector<uint8_t> expected = encoder.getEncodedBytes();
+
+    const size_t rowSize = rawBytes.size() / frameInfo.height;
+    encoder.beginEncode(frameInfo);
+    for (size_t row = 0; row < frameInfo.height; row += stripeHeight)
+    {
+        encoder.encodeStripe(rawBytes.data() + row * rowSize, std::min(stripeHeight, frameInfo.height - row));
+    }
+    encoder.finishEncode();
+    const bool matches = encoder.getEncodedBytes() == expected;
+    if (!matches)
+    {
+        printf("ERROR: stripe encode of %s does not match the full frame encode\n", inPath);
+    }
+    return matches;
+}
+
+// encodes inPath with tiles, precincts and PLT/TLM pointer markers, verifying
+// the decoder reports them and the image round trips losslessly
+bool encodeFileRandomAccess(const char *inPath, const FrameInfo frameInfo, Size tileSize, Size precinctSize)
+{
+    HTJ2KEncoder encoder;
+    std::vector<uint8_t> &rawBytes = encoder.getDecodedBytes(frameInfo);
+    readFile(inPath, rawBytes);
+    encoder.setTileSize(tileSize);
+    encoder.setPrecinctSize(precinctSize);
+    encoder.setPLTEnabled(true);
+    encoder.setTLMEnabled(true);
+    encoder.encode();
+    std::vector<uint8_t> encoded = encoder.getEncodedBytes();
+
+    HTJ2KDecoder decoder;
+    decoder.setEncodedBytes(&encoded);
+    decoder.readHeader();
+    const Size numTiles = decoder.getNumTiles();
+    const Size precinct = decoder.getPrecinctSize(0);
+    bool matches = decoder.getHasPLT() && decoder.getHasTLM() &&
+                   numTiles.width == (frameInfo.width + tileSize.width - 1) / tileSize.width &&
+                   numTiles.height == (frameInfo.height + tileSize.height - 1) / tileSize.height &&
+                   precinct.width == precinctSize.width && precinct.height == precinctSize.height;
+    decoder.decode();
+    matches = matches && decoder.getDecodedBytes() == rawBytes;
+    if (!matches)
+    {
+        printf("ERROR: tiled encode of %s with pointer markers did not round trip\n", inPath);
+    }
+
+    // the tiles decoded in parallel and the last tile on its own
+    decoder.setNumThreads(4);
+    decoder.decodeTiles(0);
+    bool tilesMatch = decoder.getDecodedBytes() == rawBytes;
+    const size_t lastTile = numTiles.width * numTiles.height - 1;
+    decoder.decodeTile(lastTile, 0);
+    const size_t bytesPerPixel = frameInfo.componentCount * ((frameInfo.bitsPerSample + 7) / 8);
+    const size_t x = (numTiles.width - 1) * tileSize.width;
+    const size_t y = (numTiles.height - 1) * tileSize.height;
+    const FrameInfo &tileInfo = decoder.getFrameInfo();
+    tilesMatch = tilesMatch && tileInfo.width == frameInfo.width - x && tileInfo.height == frameInfo.height - y;
+    for (size_t row = 0; tilesMatch && row < tileInfo.height; row++)
+    {
+        tilesMatch = std::equal(rawBytes.begin() + ((y + row) * frameInfo.width + x) * bytesPerPixel,
+                                rawBytes.begin() + ((y + row) * frameInfo.width + frameInfo.width) * bytesPerPixel,
+                                decoder.getDecodedBytes().begin() + row * tileInfo.width * bytesPerPixel);
+    }
+    if (!tilesMatch)
+    {
+        printf("ERROR: tile decode of %s does not match\n", inPath);
+    }
+    return matches && tilesMatch;
+}
+
+// encodes inPath with tiles and PLT/TLM markers then decodes a sub resolution
+// from a sparse buffer holding only the planned byte ranges, verifying it
+// matches the decode of the whole bitstream and needs fewer bytes
+bool decodeFileByteRanges(const char *inPath, const FrameInfo frameInfo, size_t decompositionLevel)
+{
+    HTJ2KEncoder encoder;
+    readFile(inPath, encoder.getDecodedBytes(frameInfo));
+    encoder.setTileSize(Size(256, 256));
+    encoder.setPrecinctSize(Size(64, 64));
+    encoder.setPLTEnabled(true);
+    encoder.setTLMEnabled(true);
+    encoder.encode();
+    std::vector<uint8_t> encoded = encoder.getEncodedBytes();
+
+    HTJ2KDecoder decoder;
+    decoder.setEncodedBytes(&encoded);
+    decoder.decodeSubResolution(decompositionLevel);
+    const std::vector<uint8_t> expected = decoder.getDecodedBytes();
+
+    // fetch the missing ranges from the "file" until the plan is complete
+    decoder.setEncodedBytes(0);
+    decoder.beginSparseDecode(encoded.size());
+    size_t fetched = 0;
+    for (size_t round = 0; round < 16; round++)
+    {
+        const std::vector<ByteRange> ranges = decoder.getMissingByteRanges(decompositionLevel, 0, 0, 0, 0, 0);
+        if (ranges.empty())
+        {
+            break;
+        }
+        for (size_t i = 0; i < ranges.size(); i++)
+        {
+            decoder.setSparseEncodedBytes(ranges[i].offset, encoded.data() + ranges[i].offset, ranges[i].length);
+            fetched += ranges[i].length;
+        }
+    }
+    decoder.decodeSubResolution(decompositionLevel);
+    const bool matches = fetched < encoded.size() && decoder.getDecodedBytes() == expected;
+    if (!matches)
+    {
+        printf("ERROR: sparse decode of %s level %zu fetched %zu of %zu bytes and does not match\n", inPath, decompositionLevel, fetched, encoded.size());
+    }
+    return matches;
+}
+
+// encodes inPath with rate control into multiple quality layers, verifying the
+// size limit is honored and that the layers can be decoded individually
+bool encodeFileRateControl(const char *inPath, const FrameInfo frameInfo, size_t targetSize, size_t numLayers)
+{
+    HTJ2KEncoder encoder;
+    readFile(inPath, encoder.getDecodedBytes(frameInfo));
+    encoder.setJP2Enabled(false);
+    encoder.setQualityLayers(numLayers);
+    encoder.setTargetSize(targetSize);
+    encoder.encode();
+    std::vector<uint8_t> encoded = encoder.getEncodedBytes();
+
+    HTJ2KDecoder decoder;
+    decoder.setEncodedBytes(&encoded);
+    decoder.readHeader();
+    bool matches = encoded.size() <= targetSize && decoder.getNumLayers() == numLayers;
+    decoder.setMaxQualityLayers(1);
+    decoder.decode();
+    const std::vector<uint8_t> firstLayer = decoder.getDecodedBytes();
+    decoder.setMaxQualityLayers(0);
+    decoder.decode();
+    matches = matches && firstLayer.size() == decoder.getDecodedBytes().size() && firstLayer != decoder.getDecodedBytes();
+    if (!matches)
+    {
+        printf("ERROR: %zu layer encode of %s limited to %zu bytes produced %zu bytes and %zu layers\n", numLayers, inPath, targetSize, encoded.size(), decoder.getNumLayers());
+    }
+    return matches;
+}
+
+// encodes numFrames copies of inPath as a batch on numThreads workers,
+// verifying every frame is identical to encoding it on its own and the stats
+// cover the whole batch
+bool encodeFileBatch(const char *inPath, const FrameInfo frameInfo, size_t numFrames, size_t numThreads)
+{
+    HTJ2KEncoder encoder;
+    std::vector<uint8_t> &rawBytes = encoder.getDecodedBytes(frameInfo);
+    readFile(inPath, rawBytes);
+    encoder.encode();
+    const std::vector<uint8_t> expected = encoder.getEncodedBytes();
+    const std::vector<uint8_t> frame = rawBytes;
+
+    std::vector<uint8_t> &frames = encoder.getBatchDecodedBytes(frameInfo, numFrames);
+    for (size_t i = 0; i < numFrames; i++)
+    {
+        std::copy(frame.begin(), frame.end(), frames.begin() + i * frame.size());
+    }
+    encoder.setNumThreads(numThreads);
+    encoder.setStatsEnabled(true);
+    encoder.encodeBatch();
+    bool matches = encoder.getBatchSize() == numFrames && encoder.getStats().bytes == numFrames * expected.size();
+    for (size_t i = 0; matches && i < numFrames; i++)
+    {
+        matches = encoder.getBatchEncodedBytes(i) == expected;
+    }
+    if (!matches)
+    {
+        printf("ERROR: batch encode of %zu frames of %s on %zu threads does not match\n", numFrames, inPath, numThreads);
+    }
+    return matches;
+}
+
+// encodes inPath with an increasing number of threads, verifying each result
+// is byte identical to the single threaded encode and printing the scaling curve
+bool encodeFileThreadScaling(const char *inPath, const FrameInfo frameInfo, size_t iterations)
+{
+    const size_t maxThreads = std::max(std::thread::hardware_concurrency(), 1u);
+    const std::vector<uint8_t> expected = encodeFile(inPath, frameInfo, NULL, iterations, false, 1);
+    bool matches = true;
+    for (size_t numThreads = 2; numThreads <= maxThreads; numThreads *= 2)
+    {
+        if (encodeFile(inPath, frameInfo, NULL, iterations, false, numThreads) != expected)
+        {
+            printf("ERROR: %zu thread encode of %s does not match single threaded encode\n", numThreads, inPath);
+            matches = false;
+        }
+    }
+    return matches;
 }
 
 int main(int argc, char **argv)
@@ -203,6 +1102,51 @@ int main(int argc, char **argv)
 
         // benchmark
         decodeFile("test/fixtures/j2c/CT1.j2c", iterations);
+
+        const VOI ctVOI = {40, 400, 1.0, 0.0, VOI_LINEAR};
+        if (!decodeFileHeader("test/fixtures/j2k/US1.j2k") ||
+            !decodeFileSubResolutions("test/fixtures/j2c/CT1.j2c") ||
+            !decodeFileRegion("test/fixtures/j2c/CT1.j2c", 100, 50, 64, 32) ||
+            !decodeFileStripes("test/fixtures/j2c/CT1.j2c", 60) ||
+            !decodeFileIncremental("test/fixtures/j2c/CT1.j2c", 16384) ||
+            !decodeFileLayers("test/fixtures/raw/CT1.RAW", {.width = 512, .height = 512, .bitsPerSample = 16, .componentCount = 1, .isSigned = true}, 3) ||
+            !decodeFileStats("test/fixtures/j2c/CT1.j2c") ||
+            !decodeFileVOI("test/fixtures/j2c/CT1.j2c", 40, 400) ||
+            !decodeFileRGBA("test/fixtures/j2k/US1.j2k", NULL) ||
+            !decodeFilePlanar("test/fixtures/j2k/US1.j2k") ||
+            !decodeSubsampledPlanar(33, 17) ||
+            !transcodeFile("test/fixtures/j2k/US1.j2k") ||
+            !transcodeFile("test/fixtures/CT1.ll.j2c") ||
+            !transcodeTruncated("test/fixtures/raw/CT1.RAW", {.width = 512, .height = 512, .bitsPerSample = 16, .componentCount = 1, .isSigned = true}, 3) ||
+            !decodeFileMapped("test/fixtures/j2c/CT1.j2c") ||
+            !decodeFileRGBA("test/fixtures/j2c/CT1.j2c", &ctVOI) ||
+            !decodeFilesSlots({"test/fixtures/j2c/CT1.j2c", "test/fixtures/j2c/CT2.j2c", "test/fixtures/j2c/MR1.j2c"}))
+        {
+            return 1;
+        }
+
+        // multi-threaded decode of a large frame
+        if (!decodeFileThreadScaling("test/fixtures/j2c/SC1.j2c", std::max(iterations / 100, (size_t)1)))
+        {
+            return 1;
+        }
+
+        if (!encodeFileRoundTrip("test/fixtures/raw/CT1.RAW", {.width = 512, .height = 512, .bitsPerSample = 16, .componentCount = 1, .isSigned = true}) ||
+            !encodeFileStripes("test/fixtures/raw/CT1.RAW", {.width = 512, .height = 512, .bitsPerSample = 16, .componentCount = 1, .isSigned = true}, 100) ||
+            !encodeComponents(4, 10) ||
+            !encodeFileRateControl("test/fixtures/raw/CT1.RAW", {.width = 512, .height = 512, .bitsPerSample = 16, .componentCount = 1, .isSigned = true}, 32768, 3) ||
+            !encodeFileRandomAccess("test/fixtures/raw/CT1.RAW", {.width = 512, .height = 512, .bitsPerSample = 16, .componentCount = 1, .isSigned = true}, Size(256, 256), Size(64, 64)) ||
+            !decodeFileByteRanges("test/fixtures/raw/CT1.RAW", {.width = 512, .height = 512, .bitsPerSample = 16, .componentCount = 1, .isSigned = true}, 2) ||
+            !encodeFileBatch("test/fixtures/raw/CT1.RAW", {.width = 512, .height = 512, .bitsPerSample = 16, .componentCount = 1, .isSigned = true}, 6, 3))
+        {
+            return 1;
+        }
+
+        // multi-threaded encode of a large frame
+        if (!encodeFileThreadScaling("test/fixtures/raw/XA1.RAW", {.width = 1024, .height = 1024, .bitsPerSample = 16, .componentCount = 1, .isSigned = false}, std::max(iterations / 100, (size_t)1)))
+        {
+            return 1;
+        }
         // decodeFile("test/fixtures/j2c/MG1.j2c", iterations);
         //  encodeFile("test/fixtures/raw/CT1.RAW", {.width = 512, .height = 512, .bitsPerSample = 16, .componentCount = 1, .isSigned = true}, NULL, iterations);
 
@@ -225,6 +1169,7 @@ int main(int argc, char **argv)
     catch (const char *pError)
     {
         printf("ERROR: %s\n", pError);
+        return 1;
     }
     return 0;
 }
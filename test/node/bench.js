@@ -0,0 +1,158 @@
+// Copyright (c) Chris Hafey.
+// SPDX-License-Identifier: MIT
+
+// Benchmarks every fixture in test/fixtures/j2c, j2k and raw with the WASM
+// build and writes the results as JSON in the same format as the native
+// benchmark (test/cpp/bench.cpp) so native and WASM results can be compared.
+//
+// usage: node bench.js [iterations] [output.json] [module]
+//
+// module defaults to ../../dist/kakadujs.js (SIMD128 WASM), pass e.g.
+// ../../dist/kakadujs-scalar.js to benchmark the scalar build
+
+const modulePath = process.argv[4] || '../../dist/kakadujs.js'
+const kakadujs = require(modulePath);
+const fs = require('fs')
+const path = require('path')
+
+const fixtures = path.join(__dirname, '..', 'fixtures')
+
+// The geometry of the raw fixtures which is not recorded in the files
+const rawFixtures = {
+  'CT1.RAW': {width: 512, height: 512, bitsPerSample: 16, componentCount: 1, isSigned: true},
+  'CT2.RAW': {width: 512, height: 512, bitsPerSample: 16, componentCount: 1, isSigned: true},
+  'MR1.RAW': {width: 512, height: 512, bitsPerSample: 16, componentCount: 1, isSigned: true},
+  'MR2.RAW': {width: 1024, height: 1024, bitsPerSample: 16, componentCount: 1, isSigned: false},
+  'MR3.RAW': {width: 512, height: 512, bitsPerSample: 16, componentCount: 1, isSigned: true},
+  'MR4.RAW': {width: 512, height: 512, bitsPerSample: 16, componentCount: 1, isSigned: false},
+  'NM1.RAW': {width: 256, height: 1024, bitsPerSample: 16, componentCount: 1, isSigned: true},
+  'US1.RAW': {width: 640, height: 480, bitsPerSample: 8, componentCount: 3, isSigned: false},
+  'VL1.RAW': {width: 756, height: 486, bitsPerSample: 8, componentCount: 3, isSigned: false},
+  'VL2.RAW': {width: 756, height: 486, bitsPerSample: 8, componentCount: 3, isSigned: false},
+  'VL3.RAW': {width: 756, height: 486, bitsPerSample: 8, componentCount: 3, isSigned: false},
+  'VL6.RAW': {width: 756, height: 486, bitsPerSample: 8, componentCount: 3, isSigned: false},
+  'XA1.RAW': {width: 1024, height: 1024, bitsPerSample: 16, componentCount: 1, isSigned: false},
+}
+
+// returns the median and 95th percentile of the samples in ms
+function getStats(samples) {
+  samples.sort((a, b) => a - b)
+  return {
+    median: samples[Math.floor(samples.length / 2)],
+    p95: samples[Math.min(Math.floor(samples.length * 0.95), samples.length - 1)]
+  }
+}
+
+// runs fn once to warm up then iterations times recording the wall clock and
+// process CPU time of each run.  fn returns false if its output is wrong
+function measure(fixture, operation, iterations, fn) {
+  let ok = fn()
+  const wall = []
+  const cpu = []
+  for (let i = 0; i < iterations; i++) {
+    const cpuStart = process.cpuUsage()
+    const wallStart = process.hrtime.bigint()
+    ok = fn() && ok
+    wall.push(Number(process.hrtime.bigint() - wallStart) / 1e6)
+    const cpuUsed = process.cpuUsage(cpuStart)
+    cpu.push((cpuUsed.user + cpuUsed.system) / 1000)
+  }
+  return {fixture, operation, width: 0, height: 0, wallMs: getStats(wall), cpuMs: getStats(cpu), ok}
+}
+
+function listFixtures(directory) {
+  return fs.readdirSync(path.join(fixtures, directory))
+    .filter(name => fs.statSync(path.join(fixtures, directory, name)).isFile())
+    .sort()
+    .map(name => directory + '/' + name)
+}
+
+kakadujs.onRuntimeInitialized = async _ => {
+  const iterations = parseInt(process.argv[2] || '20')
+  if (!(iterations >= 1)) {
+    console.log('ERROR: iterations must be at least 1')
+    process.exit(1)
+  }
+  const outputPath = process.argv[3] || 'bench-wasm.json'
+
+  const decoder = new kakadujs.HTJ2KDecoder();
+  const encoder = new kakadujs.HTJ2KEncoder();
+  const transcoder = new kakadujs.HTJ2KTranscoder();
+  const results = []
+
+  // decode and sub-resolution decode of every encoded fixture, and
+  // transcoding it to HTJ2K against a full decode and HTJ2K encode
+  for (const fixture of listFixtures('j2c').concat(listFixtures('j2k'))) {
+    const encoded = fs.readFileSync(path.join(fixtures, fixture))
+    decoder.getEncodedBuffer(encoded.length).set(encoded)
+    decoder.readHeader()
+    const frameInfo = decoder.getFrameInfo()
+
+    let result = measure('test/fixtures/' + fixture, 'decode', iterations, () => { decoder.decode(); return true })
+    result.width = frameInfo.width
+    result.height = frameInfo.height
+    results.push(result)
+
+    result = measure('test/fixtures/' + fixture, 'decodeSubResolution', iterations, () => { decoder.decodeSubResolution(1); return true })
+    result.width = decoder.getFrameInfo().width
+    result.height = decoder.getFrameInfo().height
+    results.push(result)
+
+    transcoder.getSourceBuffer(encoded.length).set(encoded)
+    result = measure('test/fixtures/' + fixture, 'transcode', iterations, () => { transcoder.transcode(); return true })
+    result.width = frameInfo.width
+    result.height = frameInfo.height
+    results.push(result)
+
+    result = measure('test/fixtures/' + fixture, 'decodeEncode', iterations, () => {
+      decoder.decode()
+      encoder.getDecodedBuffer(decoder.getFrameInfo()).set(decoder.getDecodedBuffer())
+      encoder.encode()
+      return true
+    })
+    result.width = frameInfo.width
+    result.height = frameInfo.height
+    results.push(result)
+  }
+
+  // encode and lossless round trip of every raw fixture
+  for (const fixture of listFixtures('raw')) {
+    const frameInfo = rawFixtures[path.basename(fixture)]
+    if (!frameInfo) {
+      console.log(`ERROR: no geometry for raw fixture ${fixture}, add it to rawFixtures`)
+      process.exit(1)
+    }
+    const raw = fs.readFileSync(path.join(fixtures, fixture))
+    encoder.getDecodedBuffer(frameInfo).set(raw)
+
+    let result = measure('test/fixtures/' + fixture, 'encode', iterations, () => { encoder.encode(); return true })
+    result.width = frameInfo.width
+    result.height = frameInfo.height
+    results.push(result)
+
+    result = measure('test/fixtures/' + fixture, 'roundTrip', iterations, () => {
+      encoder.encode()
+      const encoded = encoder.getEncodedBuffer()
+      decoder.getEncodedBuffer(encoded.length).set(encoded)
+      decoder.decode()
+      return Buffer.compare(Buffer.from(decoder.getDecodedBuffer()), raw) === 0
+    })
+    result.width = frameInfo.width
+    result.height = frameInfo.height
+    results.push(result)
+  }
+
+  let ok = true
+  for (const r of results) {
+    console.log(`${r.fixture.padEnd(32)} ${r.operation.padEnd(20)} wall ${r.wallMs.median.toFixed(3)} ms (p95 ${r.wallMs.p95.toFixed(3)} ms) cpu ${r.cpuMs.median.toFixed(3)} ms (p95 ${r.cpuMs.p95.toFixed(3)} ms)${r.ok ? '' : ' MISMATCH'}`)
+    ok = ok && r.ok
+  }
+  for (let i = 0; i + 1 < results.length; i++) {
+    if (results[i].operation == 'transcode' && results[i + 1].operation == 'decodeEncode') {
+      console.log(`${results[i].fixture.padEnd(32)} transcode is ${(results[i + 1].wallMs.median / Math.max(results[i].wallMs.median, 0.001)).toFixed(1)}x faster than decode + encode`)
+    }
+  }
+  fs.writeFileSync(outputPath, JSON.stringify({runtime: 'wasm', module: path.basename(modulePath), iterations, threads: 0, results}, null, 2))
+  console.log(`results written to ${outputPath}`)
+  process.exit(ok ? 0 : 1)
+}
@@ -81,6 +81,18 @@ openjphjs.onRuntimeInitialized = async _ => {
   decode('../fixtures/j2c/MG1.j2c', iterations);
   encode('../fixtures/raw/CT1.RAW', {width: 512, height: 512, bitsPerSample: 16, componentCount: 1, isSigned: true}, '../fixtures/j2c/CT1.j2c', iterations);
 
+  // invalid arguments throw to JavaScript and leave the decoder usable
+  let threw = false;
+  try {
+    decoder.decodeRegion(1000, 1000, 16, 16, 0);
+  } catch(e) {
+    threw = true;
+  }
+  decoder.decode();
+  if(!threw || decoder.getFrameInfo().width != 512) {
+    console.log('ERROR: decodeRegion outside the image did not throw');
+  }
+
   // J2K Color testing
   //decodeFile("test/fixtures/j2k/US1.j2k", 1);
 
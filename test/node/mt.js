@@ -0,0 +1,72 @@
+// Copyright (c) Chris Hafey.
+// SPDX-License-Identifier: MIT
+
+// Tests and benchmarks the multi-threaded kakadujs-mt module.  Large fixtures
+// are decoded and encoded with 1, 2, 4, ... threads, verifying the output is
+// identical to the single threaded result and printing the speedup.
+//
+// usage: node mt.js [iterations] [maxThreads]
+
+const kakadujs = require('../../dist/kakadujs-mt.js');
+const fs = require('fs')
+const os = require('os')
+
+// the module's pthread pool holds 8 workers (see src/CMakeLists.txt)
+const maxThreads = parseInt(process.argv[3] || Math.min(os.cpus().length, 8))
+const iterations = parseInt(process.argv[2] || '5')
+
+function threadCounts() {
+  const counts = []
+  for (let numThreads = 1; numThreads <= maxThreads; numThreads *= 2) {
+    counts.push(numThreads)
+  }
+  return counts
+}
+
+function time(fn) {
+  fn() // warm up
+  const start = process.hrtime.bigint()
+  for (let i = 0; i < iterations; i++) {
+    fn()
+  }
+  return Number(process.hrtime.bigint() - start) / 1e6 / iterations
+}
+
+kakadujs.onRuntimeInitialized = async _ => {
+  const decoder = new kakadujs.HTJ2KDecoder();
+  const encoder = new kakadujs.HTJ2KEncoder();
+  let ok = true
+
+  for (const path of ['../fixtures/j2c/SC1.j2c', '../fixtures/j2c/RG2.j2c']) {
+    const encoded = fs.readFileSync(path)
+    let expected, singleThreadedMs
+    for (const numThreads of threadCounts()) {
+      decoder.setNumThreads(numThreads)
+      decoder.getEncodedBuffer(encoded.length).set(encoded)
+      const ms = time(() => decoder.decode())
+      const decoded = Buffer.from(decoder.getDecodedBuffer())
+      expected = expected || decoded
+      singleThreadedMs = singleThreadedMs || ms
+      const matches = Buffer.compare(decoded, expected) === 0
+      ok = ok && matches
+      console.log(`WASM-MT decode ${path} Threads: ${numThreads} TPF=${ms.toFixed(3)} ms speedup ${(singleThreadedMs / ms).toFixed(2)}x${matches ? '' : ' MISMATCH'}`)
+    }
+  }
+
+  const frameInfo = {width: 1024, height: 1024, bitsPerSample: 16, componentCount: 1, isSigned: false}
+  const raw = fs.readFileSync('../fixtures/raw/XA1.RAW')
+  let expected, singleThreadedMs
+  for (const numThreads of threadCounts()) {
+    encoder.setNumThreads(numThreads)
+    encoder.getDecodedBuffer(frameInfo).set(raw)
+    const ms = time(() => encoder.encode())
+    const encoded = Buffer.from(encoder.getEncodedBuffer())
+    expected = expected || encoded
+    singleThreadedMs = singleThreadedMs || ms
+    const matches = Buffer.compare(encoded, expected) === 0
+    ok = ok && matches
+    console.log(`WASM-MT encode ../fixtures/raw/XA1.RAW Threads: ${numThreads} TPF=${ms.toFixed(3)} ms speedup ${(singleThreadedMs / ms).toFixed(2)}x${matches ? '' : ' MISMATCH'}`)
+  }
+
+  process.exit(ok ? 0 : 1)
+}